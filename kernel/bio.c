@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -22,34 +22,195 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
 
+#define NBUCKET 13
+
+// Buffers are allocated a page at a time. The first BSIZE
+// bytes of the page hold the chunk header, including the buf
+// structures, and the rest of the page holds their data.
+#define BPC (PGSIZE/BSIZE - 1)  // buffers per chunk
+
+struct bchunk {
+  struct bchunk *next;
+  struct buf buf[BPC];
+};
+
+// Buffers are kept in a hash table keyed by (dev, blockno), each
+// bucket a doubly-linked list with its own lock, so that lookups of
+// different blocks don't contend. A buffer with refcnt 0 stays in
+// its bucket (still caching its block) until it is recycled.
+//
+// Recycling picks the least recently released unused buffer
+// from any bucket, and moves it to the bucket of its new block.
+// bcache.lock serializes recycling: only a process holding it
+// may hold more than one bucket lock at a time, which rules out
+// deadlock between buckets, and it makes sure two processes don't
+// both decide to cache the same block.
+//
+// The cache starts with NBUF buffers and grows a chunk at a time,
+// rather than recycling, while it is smaller than 1/BCACHEFRAC of
+// the free memory. When kalloc() runs out of memory it calls
+// breclaim() to give back chunks whose buffers are all unused.
+//
+// A buffer being filled by read-ahead has refcnt 0 but b->disk
+// set; it can't be recycled until the read completes.
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct bchunk *chunks;  // list of all chunks
+  int nbuf;               // buffers in all the chunks
+  uint clock;  // stamps brelse()s, for choosing the LRU buffer
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nrahead;
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct {
+    struct spinlock lock;
+    struct buf head;
+  } bucket[NBUCKET];
 } bcache;
 
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
+// Unlink b from its bucket's list.
+// Caller holds the bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the front of bucket id.
+// Caller holds the bucket's lock.
+static void
+binsert(int id, struct buf *b)
+{
+  struct buf *head = &bcache.bucket[id].head;
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+}
+
+// Add the buffers of a new chunk in page pg to the cache.
+// They're unused and have never been used, so they are the
+// first to be recycled. Each gets a block number of device 0,
+// which is never read, that spreads them over the buckets,
+// so that every buffer is in bucket bhash(b->dev, b->blockno).
+// Caller holds bcache.lock.
+static void
+bgrow(void *pg)
+{
+  struct bchunk *c = (struct bchunk*)pg;
+  struct buf *b;
+  int id;
+
+  memset(c, 0, sizeof(*c));
+  for(b = c->buf; b < c->buf+BPC; b++){
+    initsleeplock(&b->lock, "buffer");
+    b->data = (uchar*)pg + (b - c->buf + 1) * BSIZE;
+    b->blockno = bcache.nbuf++;
+    id = bhash(b->dev, b->blockno);
+    acquire(&bcache.bucket[id].lock);
+    binsert(id, b);
+    release(&bcache.bucket[id].lock);
+  }
+  c->next = bcache.chunks;
+  bcache.chunks = c;
+}
+
+// The number of buffers the cache may grow to: a fraction of
+// the memory that is free or already holding buffers.
+static int
+bmax(void)
+{
+  int n;
+
+  n = (kfreepages() + bcache.nbuf / BPC) / BCACHEFRAC * BPC;
+  return n < NBUF ? NBUF : n;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  void *pg;
+  int i;
+
+  if(sizeof(struct bchunk) > BSIZE)
+    panic("binit: chunk header too big");
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++){
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head.prev = &bcache.bucket[i].head;
+    bcache.bucket[i].head.next = &bcache.bucket[i].head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  acquire(&bcache.lock);
+  while(bcache.nbuf < NBUF){
+    if((pg = kalloc()) == 0)
+      panic("binit: kalloc");
+    bgrow(pg);
   }
+  release(&bcache.lock);
+}
+
+// Look in bucket id for block (dev, blockno), and if it's
+// there, take a reference to it. Caller holds the bucket's lock.
+static struct buf*
+bfind(int id, uint dev, uint blockno)
+{
+  struct buf *b, *head = &bcache.bucket[id].head;
+
+  for(b = head->next; b != head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Find the least recently used (LRU) unused buffer, and return
+// it with its bucket's lock held, setting *vid to the bucket.
+// Keeps the lock of the bucket holding the best candidate so
+// far, so that the candidate can't be taken meanwhile.
+// Caller holds bcache.lock.
+static struct buf*
+blru(int *vid)
+{
+  struct buf *b, *victim;
+  int i;
+
+  victim = 0;
+  *vid = -1;
+  for(i = 0; i < NBUCKET; i++){
+    struct buf *head = &bcache.bucket[i].head;
+    int better = 0;
+
+    acquire(&bcache.bucket[i].lock);
+    for(b = head->next; b != head; b = b->next){
+      if(b->refcnt == 0 && !b->disk &&
+         (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        better = 1;
+      }
+    }
+    if(better){
+      if(*vid >= 0)
+        release(&bcache.bucket[*vid].lock);
+      *vid = i;
+    } else {
+      release(&bcache.bucket[i].lock);
+    }
+  }
+  return victim;
 }
 
 // Look through buffer cache for block on device dev.
@@ -59,33 +220,70 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  void *pg;
+  int id, vid;
 
-  acquire(&bcache.lock);
+  id = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bcache.bucket[id].lock);
+  b = bfind(id, dev, blockno);
+  release(&bcache.bucket[id].lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Not cached. If the cache may grow, get a page for more
+  // buffers before taking bcache.lock, since kalloc() may
+  // call breclaim().
+  pg = 0;
+  if(bcache.nbuf < bmax())
+    pg = kalloc();
+
+  for(;;){
+    acquire(&bcache.lock);
+
+    // Someone else may have cached it while we
+    // didn't hold the bucket lock.
+    acquire(&bcache.bucket[id].lock);
+    b = bfind(id, dev, blockno);
+    release(&bcache.bucket[id].lock);
+    if(b){
       release(&bcache.lock);
+      if(pg)
+        kfree(pg);
       acquiresleep(&b->lock);
       return b;
     }
+
+    if(pg){
+      bgrow(pg);
+      pg = 0;
+    }
+    if((b = blru(&vid)) != 0)
+      break;
+
+    // Every buffer is in use: grow past bmax().
+    release(&bcache.lock);
+    if((pg = kalloc()) == 0)
+      panic("bget: no buffers");
   }
-  panic("bget: no buffers");
+
+  bunlink(b);
+  release(&bcache.bucket[vid].lock);
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  acquire(&bcache.bucket[id].lock);
+  binsert(id, b);
+  release(&bcache.bucket[id].lock);
+
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -96,12 +294,48 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
+    // a read-ahead may be filling it.
+    virtio_disk_wait(b);
+  }
+  if(!b->valid) {
+    __sync_fetch_and_add(&bcache.nmiss, 1);
     virtio_disk_rw(b, 0);
     b->valid = 1;
+  } else {
+    __sync_fetch_and_add(&bcache.nhit, 1);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it from disk, for a caller that will overwrite all of it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(!b->valid)
+    virtio_disk_wait(b);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading the indicated block into the cache, if it
+// isn't there, without waiting for the disk, so that a later
+// bread() finds it. This is only a hint: it does nothing if
+// the disk queue is full.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(virtio_disk_read_async(b) == 0)
+    __sync_fetch_and_add(&bcache.nrahead, 1);
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -112,42 +346,114 @@ bwrite(struct buf *b)
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else is using it, stamp it as most recently used.
 void
 brelse(struct buf *b)
 {
+  int id;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  id = bhash(b->dev, b->blockno);
+  acquire(&bcache.bucket[id].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
   }
-  
-  release(&bcache.lock);
+  release(&bcache.bucket[id].lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int id = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[id].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[id].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int id = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[id].lock);
   b->refcnt--;
+  if(b->refcnt == 0)
+    b->lastuse = __sync_fetch_and_add(&bcache.clock, 1);
+  release(&bcache.bucket[id].lock);
+}
+
+// Free up to n chunks whose buffers are all unused, keeping
+// at least NBUF buffers. Called by kalloc() when it runs out
+// of memory, so it must not be called with bcache locks held.
+// Returns the number of pages freed.
+int
+breclaim(int n)
+{
+  struct bchunk *c, **cp, *freed;
+  struct buf *b, *b1;
+  int id, busy, nfreed;
+
+  // bcache.lock keeps buffers from being recycled, so from
+  // moving between buckets. Take a chunk's buffers out of their
+  // buckets one at a time, each under its bucket's lock, and put
+  // them back if one turns out to be in use. A lookup that misses
+  // one meanwhile waits for bcache.lock and then finds it.
+  acquire(&bcache.lock);
+  freed = 0;
+  nfreed = 0;
+  cp = &bcache.chunks;
+  while((c = *cp) != 0 && nfreed < n && bcache.nbuf - BPC >= NBUF){
+    busy = 0;
+    for(b = c->buf; b < c->buf+BPC && !busy; b++){
+      id = bhash(b->dev, b->blockno);
+      acquire(&bcache.bucket[id].lock);
+      busy = b->refcnt != 0 || b->disk;
+      if(!busy)
+        bunlink(b);
+      release(&bcache.bucket[id].lock);
+    }
+    if(busy){
+      for(b1 = c->buf; b1 < b - 1; b1++){
+        id = bhash(b1->dev, b1->blockno);
+        acquire(&bcache.bucket[id].lock);
+        binsert(id, b1);
+        release(&bcache.bucket[id].lock);
+      }
+      cp = &c->next;
+      continue;
+    }
+    *cp = c->next;
+    c->next = freed;
+    freed = c;
+    bcache.nbuf -= BPC;
+    nfreed++;
+  }
   release(&bcache.lock);
+
+  // freelock() takes the lock registry's lock, so do it
+  // without holding any of ours.
+  while((c = freed) != 0){
+    freed = c->next;
+    for(b = c->buf; b < c->buf+BPC; b++)
+      freelock(&b->lock.lk);
+    kfree(c);
+  }
+  return nfreed;
 }
 
+// Fill in the buffer cache's part of st.
+void
+bstat(struct fsstat *st)
+{
+  st->bhit = bcache.nhit;
+  st->bmiss = bcache.nmiss;
+  st->rahead = bcache.nrahead;
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bmax();
+}
 
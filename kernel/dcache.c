@@ -0,0 +1,163 @@
+// Directory entry cache.
+//
+// Caches the results of dirlookup(): for a directory and a
+// name, the inode number the name refers to, or that the
+// directory hasn't got the name (a negative entry), so that
+// looking up the same path again doesn't read any directory
+// blocks.
+//
+// The cache is a set-associative table of dentries keyed by
+// (dev, directory inode number, name), each set with its own
+// lock and replacing its least recently used entry. It is kept
+// up to date by the code that changes directories: dirlink()
+// and unlink() replace the entry for the name they change, and
+// freeing a directory drops all the entries under it, since
+// its inode number may be reused. All of those, like lookups,
+// hold the directory's lock, so an entry can't go stale between
+// a dirlookup() and its dinsert().
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "fsstat.h"
+
+#define NDSET 128  // sets
+#define NDWAY 4    // entries per set
+
+struct dentry {
+  uint dev;
+  uint parent;   // directory's inode number; 0 if unused
+  uint inum;     // inode number of name; 0 if it has no such entry
+  uint lastuse;
+  char name[DIRSIZ];
+};
+
+struct {
+  struct {
+    struct spinlock lock;
+    struct dentry e[NDWAY];
+  } set[NDSET];
+  uint clock;    // stamps uses, for choosing the LRU entry
+  uint64 nhit;
+  uint64 nmiss;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  int i;
+
+  for(i = 0; i < NDSET; i++)
+    initlock(&dcache.set[i].lock, "dcache.set");
+}
+
+static uint
+dhash(uint dev, uint parent, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + parent;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDSET;
+}
+
+// Find the entry for (dp, name) in set s. Caller holds its lock.
+static struct dentry*
+dfind(int s, uint dev, uint parent, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.set[s].e; d < dcache.set[s].e + NDWAY; d++){
+    if(d->parent == parent && d->dev == dev && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Look up name in directory dp. If it is cached, sets *inum
+// to its inode number, or 0 if dp has no such entry, and
+// returns 1; otherwise returns 0.
+// Caller must hold dp->lock, shared or exclusive.
+int
+dlookup(struct inode *dp, char *name, uint *inum)
+{
+  struct dentry *d;
+  int s;
+
+  s = dhash(dp->dev, dp->inum, name);
+  acquire(&dcache.set[s].lock);
+  d = dfind(s, dp->dev, dp->inum, name);
+  if(d){
+    *inum = d->inum;
+    d->lastuse = __sync_fetch_and_add(&dcache.clock, 1);
+  }
+  release(&dcache.set[s].lock);
+  if(d)
+    __sync_fetch_and_add(&dcache.nhit, 1);
+  else
+    __sync_fetch_and_add(&dcache.nmiss, 1);
+  return d != 0;
+}
+
+// Record that name in directory dp refers to inode inum,
+// or with inum 0, that dp has no such entry.
+// Caller must hold dp->lock, shared or exclusive.
+void
+dinsert(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, *victim;
+  int s;
+
+  s = dhash(dp->dev, dp->inum, name);
+  acquire(&dcache.set[s].lock);
+  if((victim = dfind(s, dp->dev, dp->inum, name)) == 0){
+    victim = dcache.set[s].e;
+    for(d = dcache.set[s].e; d < dcache.set[s].e + NDWAY; d++){
+      if(d->parent == 0){
+        victim = d;
+        break;
+      }
+      if(d->lastuse < victim->lastuse)
+        victim = d;
+    }
+    victim->dev = dp->dev;
+    victim->parent = dp->inum;
+    strncpy(victim->name, name, DIRSIZ);
+  }
+  victim->inum = inum;
+  victim->lastuse = __sync_fetch_and_add(&dcache.clock, 1);
+  release(&dcache.set[s].lock);
+}
+
+// Forget the entries of directory inode inum on dev, which
+// is being freed.
+void
+dpurge(uint dev, uint inum)
+{
+  struct dentry *d;
+  int s;
+
+  for(s = 0; s < NDSET; s++){
+    acquire(&dcache.set[s].lock);
+    for(d = dcache.set[s].e; d < dcache.set[s].e + NDWAY; d++){
+      if(d->parent == inum && d->dev == dev)
+        d->parent = 0;
+    }
+    release(&dcache.set[s].lock);
+  }
+}
+
+// Fill in the dentry cache's part of st.
+void
+dcachestat(struct fsstat *st)
+{
+  st->dhit = dcache.nhit;
+  st->dmiss = dcache.nmiss;
+}
@@ -1,6 +1,7 @@
 struct buf;
 struct context;
 struct file;
+struct fsstat;
 struct inode;
 struct pipe;
 struct proc;
@@ -12,10 +13,14 @@ struct superblock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            breadahead(uint, uint);
+int             breclaim(int);
+void            bstat(struct fsstat*);
 
 // console.c
 void            consoleinit(void);
@@ -38,14 +43,17 @@ int             filewrite(struct file*, uint64, int n);
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilock_shared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
+void            iunlock_shared(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            iwritedirty(void);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -53,6 +61,20 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+void            itrunclater(struct inode*);
+void            ireap(int);
+void            allocstat(struct fsstat*);
+void            icachestat(struct fsstat*);
+void            iflush(struct inode*);
+void            iflushall(void);
+void            bsettle(uint);
+
+// dcache.c
+void            dcacheinit(void);
+int             dlookup(struct inode*, char*, uint*);
+void            dinsert(struct inode*, char*, uint);
+void            dpurge(uint, uint);
+void            dcachestat(struct fsstat*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -63,11 +85,17 @@ void            ramdiskrw(struct buf*);
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+int             kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
+void            log_force(void);
+void            log_ordered(struct buf*);
+void            log_free(uint, uint);
+int             log_busy(uint);
+void            logstat(struct fsstat*);
+void            begin_op(int);
 void            end_op(void);
 
 // pipe.c
@@ -89,6 +117,7 @@ int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -96,6 +125,7 @@ void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+int             settickets(int);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
@@ -115,11 +145,16 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+void            freelock(struct spinlock*);
+int             lockstat(uint64, int);
+void            lockreset(void);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            acquiresleep_shared(struct sleeplock*);
+void            releasesleep_shared(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -181,6 +216,9 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_read_async(struct buf *);
+void            virtio_disk_wait(struct buf *);
+void            virtio_disk_stat(struct fsstat*);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -18,6 +18,13 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // hash bucket list, see iget() in fs.c
+  uint lastuse;       // when ref last dropped to 0
+  int dirty;          // changed by the open transaction, see iupdate()
+  struct inode *dnext; // list of dirty inodes
+  uint raoff;         // Read-ahead hints, see readahead() in fs.c
+  uint rawin;
+  uint raend;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +33,18 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint flags;
+  union {
+    uint addrs[NDIRECT+NLEVEL];
+    struct extentroot ext;
+    uchar data[NINLINE];
+  };
+  uint dstart;        // first file block waiting for a disk block
+  uint ndelay;        // how many, see iflush() in fs.c
+  char *delay[NDELAY/4]; // pages holding their data, 4 blocks each
+  struct spinlock bmlock; // protects the block map cache:
+  struct extent bmc[NBMAP]; // runs of blocks bmap() looked up
+  int bmnext;         // which run to replace next
 };
 
 // map major device number to device functions.
@@ -20,12 +20,19 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "fsstat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+// free blocks ialloc() leaves in a group for its files to grow into
+#define GRESERVE (BPG/16)
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+static void bsuminit(int);
+static void isuminit(int);
+static void orphaninit(int);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -43,63 +50,214 @@ fsinit(int dev) {
   readsb(dev, &sb);
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
+  if(sb.size > FSSIZE)
+    panic("fsinit: file system too big");
   initlog(dev, &sb);
+  bsuminit(dev);
+  isuminit(dev);
+  orphaninit(dev);
 }
 
-// Zero a block.
+// Zero a block. A file data block is zeroed in place
+// rather than through the log.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_ordered(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// A summary of the free-block bitmaps, kept in memory so that
+// balloc() can skip groups with nothing free and ialloc() can
+// choose groups for new inodes, and a next-fit hint: where the
+// last allocation ended. nfree[g] counts the free blocks of
+// group g; it's changed only while holding the group's bitmap
+// block, but read as a hint without it.
+static struct {
+  struct spinlock lock;
+  uint nfree[FSSIZE/BPG + 1];
+  uint hint;
+  uint total;
+  uint reserved;  // of total, promised to allocations to come
+  uint busy;      // of total, freed but not installed, see log_busy()
+} bsum;
+
+// Number of blocks in group g; the last may be short.
 static uint
-balloc(uint dev)
+glen(uint g)
+{
+  return min(BPG, sb.size - GSTART(g, sb));
+}
+
+// Count the free blocks in each group.
+static void
+bsuminit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint g, bi;
+
+  initlock(&bsum.lock, "bsum");
+  for(g = 0; g < sb.ngroups; g++){
+    bp = bread(dev, BBLOCK(GSTART(g, sb), sb));
+    for(bi = 0; bi < glen(g); bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[g]++;
+    }
+    bsum.total += bsum.nfree[g];
+    brelse(bp);
+  }
+  bsum.hint = GDATA(0, sb);
+}
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+// Allocate up to n contiguous zeroed disk blocks, for file
+// data if data is set, preferably starting at block goal, or
+// else at the first free block after it, in its group or the
+// ones after. If goal is 0, starts from where the last
+// allocation ended. Sets *got to the number allocated, at
+// least 1, and returns the first. Skips blocks freed by
+// transactions not installed yet.
+static uint
+balloc_range(uint dev, uint goal, uint n, uint *got, int data)
+{
+  uint i, g, bi, from, k, start;
+  struct buf *bp;
+
+  if(goal < sb.gstart || goal >= sb.size)
+    goal = bsum.hint;
+  // visit goal's group first, and again last for
+  // the blocks before goal.
+  for(i = 0; i <= sb.ngroups; i++){
+    g = (BGROUP(goal, sb) + i) % sb.ngroups;
+    from = i == 0 ? BBIT(goal, sb) : 0;
+    if(bsum.nfree[g] == 0)
+      continue;
+    bp = bread(dev, BBLOCK(GSTART(g, sb), sb));
+    for(bi = from; bi < glen(g); bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) != 0 || log_busy(GSTART(g, sb) + bi))
+        continue;
+      // take it, and as many after it as are free.
+      for(k = 0; k < n && bi + k < glen(g); k++){
+        uint m = 1 << ((bi + k) % 8);
+        if((bp->data[(bi + k)/8] & m) != 0 || (k > 0 && log_busy(GSTART(g, sb) + bi + k)))
+          break;
+        bp->data[(bi + k)/8] |= m;  // Mark block in use.
       }
+      log_write(bp);
+      start = GSTART(g, sb) + bi;
+      acquire(&bsum.lock);
+      bsum.nfree[g] -= k;
+      bsum.total -= k;
+      bsum.hint = start + k;
+      release(&bsum.lock);
+      brelse(bp);
+      for(i = 0; i < k; i++)
+        bzero(dev, start + i, data);
+      *got = k;
+      return start;
     }
     brelse(bp);
   }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, for file data if data is set,
+// at or after goal if possible.
+static uint
+balloc(uint dev, uint goal, int data)
+{
+  uint got;
+
+  return balloc_range(dev, goal, 1, &got, data);
+}
+
+// Free the n disk blocks starting at b, updating each
+// bitmap block once.
+static void
+bfree_range(int dev, uint b, uint n)
+{
+  struct buf *bp;
+  uint end, bi, g, k;
+  int m;
+
+  log_free(b, n);
+  end = b + n;
+  while(b < end){
+    bp = bread(dev, BBLOCK(b, sb));
+    g = BGROUP(b, sb);
+    k = 0;
+    do {
+      bi = BBIT(b, sb);
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      b++;
+      k++;
+    } while(b < end && BBIT(b, sb) != 0);
+    log_write(bp);
+    acquire(&bsum.lock);
+    bsum.nfree[g] += k;
+    bsum.total += k;
+    bsum.busy += k;
+    release(&bsum.lock);
+    brelse(bp);
+  }
+}
+
+// The transaction that freed n blocks has been installed,
+// so they may be allocated again.
+void
+bsettle(uint n)
+{
+  acquire(&bsum.lock);
+  bsum.busy -= n;
+  release(&bsum.lock);
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
 {
-  struct buf *bp;
-  int bi, m;
-
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  bfree_range(dev, b, 1);
+}
+
+// Reserve n of the free blocks, so that allocating them later
+// can't fail. Returns -1 if fewer than n can be allocated and
+// aren't reserved already. Everything that allocates blocks
+// reserves them first, or holds a reservation from earlier,
+// as for delayed blocks, so none takes blocks promised to
+// another.
+static int
+breserve(uint n)
+{
+  int r;
+
+  r = -1;
+  acquire(&bsum.lock);
+  if(bsum.total >= bsum.reserved + bsum.busy + n){
+    bsum.reserved += n;
+    r = 0;
+  }
+  release(&bsum.lock);
+  return r;
+}
+
+// Give back n reserved blocks.
+static void
+bunreserve(uint n)
+{
+  acquire(&bsum.lock);
+  bsum.reserved -= n;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -124,8 +282,9 @@ bfree(int dev, uint b)
 // rest of the file system code.
 //
 // * Allocation: an inode is allocated if its type (on disk)
-//   is non-zero. ialloc() allocates, and iput() frees if
-//   the reference and link counts have fallen to zero.
+//   is non-zero, and then its bit in the inode bitmap is set.
+//   ialloc() allocates, and iput() frees if the reference
+//   and link counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
 //   is free if ip->ref is zero. Otherwise ip->ref tracks
@@ -162,78 +321,462 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The inode cache is a hash table keyed by (dev, inum), each
+// bucket a list with its own lock, in the manner of the buffer
+// cache in bio.c. Since ip->ref indicates whether an entry is in
+// use, and ip->dev and ip->inum indicate which i-node an entry
+// holds, one must hold the lock of the entry's bucket while using
+// any of those fields. An entry with ref 0 stays in its bucket,
+// still caching its inode, until it is recycled.
+//
+// Recycling picks the least recently put unused entry from any
+// bucket, other than dirty ones waiting for the transaction that
+// changed them to close (see iupdate()), and moves it to the
+// bucket of its new inode; icache.lock
+// serializes it, as bcache.lock does for buffers. When every
+// entry is in use, iget() grows the cache by a page of entries
+// instead of failing. The cache starts with NINODE entries.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// Code that only reads the inode and its content (readi, stati,
+// dirlookup) may hold ip->lock shared, via ilock_shared(), so that
+// several readers of one file can run in parallel; code that
+// modifies them (writei, itrunc, iupdate) must hold it exclusively.
+
+#define NIBUCKET 61
+
+// Inodes are allocated a page of them at a time.
+#define IPC ((PGSIZE - sizeof(void*)) / sizeof(struct inode))  // inodes per chunk
+
+struct ichunk {
+  struct ichunk *next;
+  struct inode inode[IPC];
+};
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct ichunk *chunks;  // list of all chunks
+  int ninode;             // inodes in all the chunks
+  uint clock;  // stamps iput()s, for choosing the LRU inode
+  uint64 nhit;
+  uint64 nmiss;
+
+  struct {
+    struct spinlock lock;
+    struct inode *head;
+  } bucket[NIBUCKET];
 } icache;
 
+// Inodes changed by the open transaction, see iupdate().
+struct {
+  struct spinlock lock;
+  struct inode *head;  // list linked through ip->dnext
+  uint64 nupdate;      // iupdate() calls
+  uint64 nwrite;       // inodes copied to their blocks
+} idirty;
+
+static uint
+ihash(uint dev, uint inum)
+{
+  return (dev * 31 + inum) % NIBUCKET;
+}
+
+// Insert ip at the front of bucket id.
+// Caller holds the bucket's lock.
+static void
+iinsert(int id, struct inode *ip)
+{
+  ip->next = icache.bucket[id].head;
+  icache.bucket[id].head = ip;
+}
+
+// Unlink ip from bucket id's list.
+// Caller holds the bucket's lock.
+static void
+iunlink(int id, struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &icache.bucket[id].head; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+}
+
+// Add the inodes of a new chunk in page pg to the cache.
+// They have never been used, so they are the first to be
+// recycled. Caller holds icache.lock.
+static void
+icgrow(void *pg)
+{
+  struct ichunk *c = (struct ichunk*)pg;
+  struct inode *ip;
+  int id;
+
+  memset(c, 0, sizeof(*c));
+  for(ip = c->inode; ip < c->inode+IPC; ip++){
+    initsleeplock(&ip->lock, "inode");
+    initlock(&ip->bmlock, "bmap");
+    id = icache.ninode++ % NIBUCKET;
+    acquire(&icache.bucket[id].lock);
+    iinsert(id, ip);
+    release(&icache.bucket[id].lock);
+  }
+  c->next = icache.chunks;
+  icache.chunks = c;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  void *pg;
+  int i;
+
+  if(sizeof(struct ichunk) > PGSIZE)
+    panic("iinit: chunk too big");
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+  initlock(&idirty.lock, "idirty");
+  for(i = 0; i < NIBUCKET; i++)
+    initlock(&icache.bucket[i].lock, "icache.bucket");
+
+  acquire(&icache.lock);
+  while(icache.ninode < NINODE){
+    if((pg = kalloc()) == 0)
+      panic("iinit: kalloc");
+    icgrow(pg);
   }
+  release(&icache.lock);
+  dcacheinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void bmforget(struct inode *ip);
+static void idiscard(struct inode *ip);
+static int ibig(struct inode *ip);
+static int iorphan(struct inode *ip, int held);
+
+// Each group's inode bitmap has a bit per inode of the group,
+// set while it is allocated, so that ialloc() needn't read the
+// inodes to find a free one. isum counts the free inodes of each
+// group, and keeps a hint: no inode below it is free.
+static struct {
+  struct spinlock lock;
+  uint nfree[FSSIZE/BPG + 1];
+  uint total;
+  uint hint;
+} isum;
 
-// Allocate an inode on device dev.
-// Mark it as allocated by  giving it type type.
-// Returns an unlocked but allocated and referenced inode.
-struct inode*
-ialloc(uint dev, short type)
+// Orphans, see iorphan().
+static struct {
+  struct spinlock lock;
+  int dev;
+  int n;        // orphans listed
+  int nheld;    // free slots promised by orphanhold()
+} orphans;
+
+// Count the free inodes in each group.
+static void
+isuminit(int dev)
 {
-  int inum;
   struct buf *bp;
-  struct dinode *dip;
+  uint g, inum;
+
+  initlock(&isum.lock, "isum");
+  isum.hint = sb.ninodes;
+  for(g = 0; g < sb.ngroups; g++){
+    bp = bread(dev, IMBLOCK(g * sb.ipg, sb));
+    for(inum = g * sb.ipg; inum < (g + 1) * sb.ipg; inum++){
+      if(inum == 0 || (bp->data[IMBIT(inum, sb)/8] & (1 << (IMBIT(inum, sb) % 8))) != 0)
+        continue;
+      isum.nfree[g]++;
+      if(inum < isum.hint)
+        isum.hint = inum;
+    }
+    isum.total += isum.nfree[g];
+    brelse(bp);
+  }
+}
+
+// Find a free inode in [from, to) in the inode bitmaps, and
+// mark it allocated. Returns 0 if there is none.
+static uint
+iscan(uint dev, uint from, uint to)
+{
+  struct buf *bp;
+  uint inum;
+  int m;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
+  bp = 0;
+  for(inum = from; inum < to; inum++){
+    if(bp == 0 || IMBIT(inum, sb) == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IMBLOCK(inum, sb));
+    }
+    m = 1 << (IMBIT(inum, sb) % 8);
+    if(inum != 0 && (bp->data[IMBIT(inum, sb) / 8] & m) == 0){
+      bp->data[IMBIT(inum, sb) / 8] |= m;
+      log_write(bp);
       brelse(bp);
-      return iget(dev, inum);
+      return inum;
     }
+  }
+  if(bp)
     brelse(bp);
+  return 0;
+}
+
+// Choose a group for a new inode that isn't to go near its
+// directory: of the groups with at least the average number
+// of free blocks, the one with the most free inodes. So new
+// directories are spread over the disk, each with room for
+// its files.
+static uint
+ichoose(void)
+{
+  uint g, best, avg;
+
+  avg = bsum.total / sb.ngroups;
+  best = IGROUP(isum.hint, sb);
+  for(g = 0; g < sb.ngroups; g++){
+    if(bsum.nfree[g] >= avg && isum.nfree[g] > isum.nfree[best])
+      best = g;
   }
-  panic("ialloc: no inodes");
+  return best;
 }
 
-// Copy a modified in-memory inode to disk.
-// Must be called after every change to an ip->xxx field
-// that lives on disk, since i-node cache is write-through.
-// Caller must hold ip->lock.
-void
-iupdate(struct inode *ip)
+// Allocate an inode on device dev. A new directory goes in a
+// lightly used group, and anything else preferably in the
+// first free inode after near, so that the files of a directory
+// are close together, unless near's group is short of free
+// blocks: the rest of those are left for its files to grow into.
+// Mark it as allocated by giving it type type.
+// Returns an unlocked but allocated and referenced inode.
+struct inode*
+ialloc(uint dev, short type, uint near)
 {
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(isum.total == 0)
+    panic("ialloc: no inodes");
+  if(near == 0 || near >= sb.ninodes)
+    near = isum.hint;
+  if(type == T_DIR || bsum.nfree[IGROUP(near, sb)] < GRESERVE)
+    near = ichoose() * sb.ipg;
+  inum = iscan(dev, near, sb.ninodes);
+  if(inum == 0)
+    inum = iscan(dev, isum.hint, near);
+  if(inum == 0)
+    panic("ialloc: no inodes");
+
+  acquire(&isum.lock);
+  isum.nfree[IGROUP(inum, sb)]--;
+  isum.total--;
+  if(inum == isum.hint)
+    isum.hint++;
+  release(&isum.lock);
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  dip->flags = I_INLINE;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
+// Mark inode inum free in the inode bitmap.
+static void
+ifree(uint dev, uint inum)
+{
+  struct buf *bp;
+  int m;
+
+  bp = bread(dev, IMBLOCK(inum, sb));
+  m = 1 << (IMBIT(inum, sb) % 8);
+  if((bp->data[IMBIT(inum, sb) / 8] & m) == 0)
+    panic("freeing free inode");
+  bp->data[IMBIT(inum, sb) / 8] &= ~m;
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&isum.lock);
+  isum.nfree[IGROUP(inum, sb)]++;
+  isum.total++;
+  if(inum < isum.hint)
+    isum.hint = inum;
+  release(&isum.lock);
+}
+
+// Fill in the block and inode allocators' part of st.
+void
+allocstat(struct fsstat *st)
+{
+  st->nfree = bsum.total;
+  st->nreserved = bsum.reserved;
+  st->nifree = isum.total;
+  st->norphan = orphans.n;
+}
+
+// Fill in the inode cache's part of st.
+void
+icachestat(struct fsstat *st)
+{
+  st->ihit = icache.nhit;
+  st->imiss = icache.nmiss;
+  st->ninode = icache.ninode;
+  st->niupdate = idirty.nupdate;
+  st->niwrite = idirty.nwrite;
+}
+
+// Copy ip's on-disk fields to its inode in block bp.
+static void
+icopy(struct inode *ip, struct buf *bp)
+{
+  struct dinode *dip;
+
   dip = (struct dinode*)bp->data + ip->inum%IPB;
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  if(ip->ndelay > 0)
+    dip->size = min(ip->size, ip->dstart * BSIZE);  // see iflush()
+  dip->flags = ip->flags;
+  memmove(&dip->ext, &ip->ext, sizeof(ip->ext));
+}
+
+// Record that a modified in-memory inode must go to disk.
+// Must be called after every change to an ip->xxx field
+// that lives on disk.
+// Rather than copying the inode to its block every time, the
+// first call in a transaction adds the block to the transaction,
+// under the caller's reservation, and marks ip dirty; when the
+// transaction is closed, iwritedirty() copies each dirty inode
+// to its block once.
+// Caller must hold ip->lock exclusively.
+void
+iupdate(struct inode *ip)
+{
+  struct buf *bp;
+
+  if(!holdingsleep(&ip->lock))
+    panic("iupdate");
+
+  __sync_fetch_and_add(&idirty.nupdate, 1);
+  if(ip->dirty)
+    return;
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  log_write(bp);
+  brelse(bp);
+  acquire(&idirty.lock);
+  ip->dirty = 1;
+  ip->dnext = idirty.head;
+  idirty.head = ip;
+  release(&idirty.lock);
+}
+
+// Copy the inodes that iupdate() marked dirty to their blocks.
+// Called by the log as it closes the open transaction, which
+// already holds the blocks. No FS operation is in progress
+// then, so the inodes can't change meanwhile.
+void
+iwritedirty(void)
+{
+  struct inode *ip, *next;
+  struct buf *bp;
+
+  acquire(&idirty.lock);
+  ip = idirty.head;
+  idirty.head = 0;
+  release(&idirty.lock);
+
+  for(; ip; ip = next){
+    next = ip->dnext;
+    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    icopy(ip, bp);
+    brelse(bp);
+    __sync_fetch_and_add(&idirty.nwrite, 1);
+    // once clean, the cache entry may be recycled.
+    ip->dirty = 0;
+  }
+}
+
+// Mark ip, whose blocks have been freed, free on disk.
+// Caller must hold ip->lock exclusively, in a transaction.
+static void
+ifreeinode(struct inode *ip)
+{
+  struct buf *bp;
+
+  if(ip->type == T_DIR)
+    dpurge(ip->dev, ip->inum);
+  ip->type = 0;
+  iupdate(ip);
+  // write the free inode through now, not at commit, since
+  // ialloc() may hand it out again before then.
+  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  icopy(ip, bp);
   log_write(bp);
   brelse(bp);
+  ifree(ip->dev, ip->inum);
+  ip->valid = 0;
+}
+
+// Look in bucket id for inode (dev, inum), and if it's
+// there, take a reference to it. Caller holds the bucket's lock.
+static struct inode*
+ifind(int id, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = icache.bucket[id].head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      ip->ref++;
+      return ip;
+    }
+  }
+  return 0;
+}
+
+// Find the least recently used unused inode, and return it
+// with its bucket's lock held, setting *vid to the bucket.
+// Caller holds icache.lock.
+static struct inode*
+ilru(int *vid)
+{
+  struct inode *ip, *victim;
+  int i, better;
+
+  victim = 0;
+  *vid = -1;
+  for(i = 0; i < NIBUCKET; i++){
+    better = 0;
+    acquire(&icache.bucket[i].lock);
+    for(ip = icache.bucket[i].head; ip; ip = ip->next){
+      if(ip->ref == 0 && !ip->dirty &&
+         (victim == 0 || ip->lastuse < victim->lastuse)){
+        victim = ip;
+        better = 1;
+      }
+    }
+    if(better){
+      if(*vid >= 0)
+        release(&icache.bucket[*vid].lock);
+      *vid = i;
+    } else {
+      release(&icache.bucket[i].lock);
+    }
+  }
+  return victim;
 }
 
 // Find the inode with number inum on device dev
@@ -242,31 +785,65 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  void *pg;
+  int id, vid;
 
-  acquire(&icache.lock);
+  id = ihash(dev, inum);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  acquire(&icache.bucket[id].lock);
+  ip = ifind(id, dev, inum);
+  release(&icache.bucket[id].lock);
+  if(ip){
+    __sync_fetch_and_add(&icache.nhit, 1);
+    return ip;
+  }
+  __sync_fetch_and_add(&icache.nmiss, 1);
+
+  pg = 0;
+  for(;;){
+    acquire(&icache.lock);
+
+    // Someone else may have cached it while we
+    // didn't hold the bucket lock.
+    acquire(&icache.bucket[id].lock);
+    ip = ifind(id, dev, inum);
+    release(&icache.bucket[id].lock);
+    if(ip){
       release(&icache.lock);
+      if(pg)
+        kfree(pg);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    if(pg){
+      icgrow(pg);
+      pg = 0;
+    }
+    if((ip = ilru(&vid)) != 0)
+      break;
+
+    // Every entry is in use. Get a page for more, without
+    // holding icache.lock, since kalloc() may call breclaim().
+    release(&icache.lock);
+    if((pg = kalloc()) == 0)
+      panic("iget: no inodes");
+  }
 
-  ip = empty;
+  // Recycle the entry.
+  iunlink(vid, ip);
+  release(&icache.bucket[vid].lock);
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->raoff = 0;
+  ip->rawin = 0;
+  ip->raend = 0;
+  acquire(&icache.bucket[id].lock);
+  iinsert(id, ip);
+  release(&icache.bucket[id].lock);
   release(&icache.lock);
 
   return ip;
@@ -277,9 +854,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  int id = ihash(ip->dev, ip->inum);
+
+  acquire(&icache.bucket[id].lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&icache.bucket[id].lock);
   return ip;
 }
 
@@ -304,14 +883,35 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->flags = dip->flags;
+    memmove(&ip->ext, &dip->ext, sizeof(ip->ext));
     brelse(bp);
+    bmforget(ip);
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
   }
 }
 
+// Lock the given inode shared, for reading only.
+// Reads the inode from disk if necessary.
+void
+ilock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock_shared");
+
+  // Fill the inode under an exclusive lock, so that shared
+  // holders never see it half-read. Once valid, it stays valid
+  // as long as we hold a reference.
+  if(ip->valid == 0){
+    ilock(ip);
+    iunlock(ip);
+  }
+
+  acquiresleep_shared(&ip->lock);
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
@@ -322,17 +922,41 @@ iunlock(struct inode *ip)
   releasesleep(&ip->lock);
 }
 
+// Unlock an inode locked with ilock_shared().
+void
+iunlock_shared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("iunlock_shared");
+
+  releasesleep_shared(&ip->lock);
+}
+
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
+// to it, free the inode (and its content) on disk, or for a big
+// file make it an orphan for the orphan worker to free; if it
+// still has links, give its delayed blocks disk blocks.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  int id = ihash(ip->dev, ip->inum);
+
+  acquire(&icache.bucket[id].lock);
+
+  if(ip->ref == 1 && ip->valid && ip->nlink > 0 && ip->ndelay > 0){
+    // the cache entry may be recycled once ip->ref is 0, so
+    // write out the data it holds; as below, this won't block.
+    acquiresleep(&ip->lock);
+    release(&icache.bucket[id].lock);
+    iflush(ip);
+    releasesleep(&ip->lock);
+    acquire(&icache.bucket[id].lock);
+  }
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -341,20 +965,25 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&icache.lock);
+    release(&icache.bucket[id].lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
-    ip->valid = 0;
+    if(ibig(ip) && iorphan(ip, 0) == 0){
+      // the orphan worker will free it.
+      idiscard(ip);
+    } else {
+      itrunc(ip);
+      ifreeinode(ip);
+    }
 
     releasesleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquire(&icache.bucket[id].lock);
   }
 
   ip->ref--;
-  release(&icache.lock);
+  if(ip->ref == 0)
+    ip->lastuse = __sync_fetch_and_add(&icache.clock, 1);
+  release(&icache.bucket[id].lock);
 }
 
 // Common idiom: unlock, then put.
@@ -370,48 +999,599 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the ones after that
+// in a tree of indirect blocks NLEVEL deep at most, whose
+// roots are ip->addrs[NDIRECT+1] and so on.
+//
+// Inodes allocated by ialloc() use extents instead (I_EXTENTS),
+// see extmap(). Files only grow at the end, so a new block is
+// always appended to the last extent, or a new extent after it.
+//
+// Until it grows past NINLINE bytes, though, a new file has no
+// blocks at all: its data is kept in the inode, in ip->data[],
+// and flagged I_INLINE. writei() moves it to blocks, with
+// extents, when it no longer fits, and itrunc() brings an
+// emptied file back to I_INLINE.
 
-// Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// Where to allocate ip's blocks: in its inode's group.
 static uint
-bmap(struct inode *ip, uint bn)
+bgoal(struct inode *ip)
 {
-  uint addr, *a;
-  struct buf *bp;
+  return GDATA(IGROUP(ip->inum, sb), sb);
+}
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+// The block map cache. Finding a block of a big file means
+// reading an indirect block, or an extent tree node, every time
+// the block is read or written. So bmap() remembers the last
+// NBMAP runs of contiguous blocks it found that way in the
+// inode, in ip->bmc[], and looks there first. Blocks are only
+// added to a file's map until itrunc() empties it, so a run stays
+// right until then. Several shared holders of ip->lock may look
+// up blocks at once, so ip->bmlock protects the cache.
+
+// Look up file block bn of ip in the block map cache. Returns
+// its disk block, or 0 if it isn't cached.
+static uint
+bmcached(struct inode *ip, uint bn)
+{
+  struct extent *x;
+  uint addr;
+
+  addr = 0;
+  acquire(&ip->bmlock);
+  for(x = ip->bmc; x < ip->bmc + NBMAP; x++){
+    if(bn >= x->lblk && bn < x->lblk + x->len){
+      addr = x->start + (bn - x->lblk);
+      break;
+    }
   }
-  bn -= NDIRECT;
+  release(&ip->bmlock);
+  return addr;
+}
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+// Remember that ip's file blocks from x->lblk are the x->len
+// disk blocks from x->start, replacing the oldest run cached.
+static void
+bmremember(struct inode *ip, struct extent *x)
+{
+  acquire(&ip->bmlock);
+  ip->bmc[ip->bmnext] = *x;
+  ip->bmnext = (ip->bmnext + 1) % NBMAP;
+  release(&ip->bmlock);
+}
+
+// Empty ip's block map cache.
+static void
+bmforget(struct inode *ip)
+{
+  acquire(&ip->bmlock);
+  memset(ip->bmc, 0, sizeof(ip->bmc));
+  ip->bmnext = 0;
+  release(&ip->bmlock);
+}
+
+// Remember the run of contiguous blocks around entry i of
+// the indirect block a, which maps file block bn.
+static void
+bmrun(struct inode *ip, uint *a, uint i, uint bn)
+{
+  struct extent x;
+  uint lo, hi;
+
+  for(lo = i; lo > 0 && a[lo-1] != 0 && a[lo-1] + 1 == a[lo]; lo--)
+    ;
+  for(hi = i; hi + 1 < NINDIRECT && a[hi+1] != 0 && a[hi] + 1 == a[hi+1]; hi++)
+    ;
+  x.lblk = bn - (i - lo);
+  x.start = a[lo];
+  x.len = hi - lo + 1;
+  bmremember(ip, &x);
+}
+
+// Find the entry of node (h, e) that covers file block bn:
+// the last one starting at or before it.
+static struct extent*
+extfind(struct extenthdr *h, struct extent *e, uint bn)
+{
+  int i;
+
+  for(i = h->n - 1; i > 0 && e[i].lblk > bn; i--)
+    ;
+  return h->n > 0 ? &e[i] : 0;
+}
+
+// Look up file block bn in ip's extent tree. Returns its disk
+// block, or 0 if it isn't mapped.
+static uint
+extlookup(struct inode *ip, uint bn)
+{
+  struct extent *x, found;
+  struct extentblk *eb;
+  struct buf *bp;
+  uint addr;
+
+  x = extfind(&ip->ext.h, ip->ext.e, bn);
+  if(x == 0)
+    return 0;
+  if(ip->ext.h.depth == 0)
+    return bn < x->lblk + x->len ? x->start + (bn - x->lblk) : 0;
+  if((addr = bmcached(ip, bn)) != 0)
+    return addr;
+  for(;;){
+    bp = bread(ip->dev, x->start);
+    eb = (struct extentblk*)bp->data;
+    x = extfind(&eb->h, eb->e, bn);
+    if(x == 0)
+      panic("extlookup: empty node");
+    found = *x;
+    if(eb->h.depth == 0){
+      brelse(bp);
+      if(bn >= found.lblk + found.len)
+        return 0;
+      bmremember(ip, &found);
+      return found.start + (bn - found.lblk);
+    }
+    brelse(bp);
+    x = &found;
+  }
+}
+
+// Allocate an extent block for a new node holding just x,
+// at height depth.
+static uint
+extnode(struct inode *ip, int depth, struct extent *x)
+{
+  struct extentblk *eb;
+  struct buf *bp;
+  uint b;
+
+  b = balloc(ip->dev, bgoal(ip), 0);
+  bp = bread(ip->dev, b);
+  eb = (struct extentblk*)bp->data;
+  eb->h.depth = depth;
+  eb->h.n = 1;
+  eb->e[0] = *x;
+  log_write(bp);
+  brelse(bp);
+  return b;
+}
+
+// Append extent x to the subtree with root node
+// (h, e), which has room for max entries, extending its last
+// extent if x follows on from it. Returns 0, or if the node is
+// full, a new node to go to its right in the parent.
+// Caller logs (h, e) if it returns 0.
+static uint
+extappend(struct inode *ip, struct extenthdr *h, struct extent *e, int max, struct extent *x)
+{
+  struct extentblk *eb;
+  struct extent *last, ix;
+  struct buf *bp;
+  uint b;
+
+  last = h->n > 0 ? &e[h->n - 1] : 0;
+  if(h->depth == 0){
+    if(last && last->lblk + last->len == x->lblk &&
+       last->start + last->len == x->start){
+      last->len += x->len;
+      return 0;
+    }
+    if(h->n < max){
+      e[h->n++] = *x;
+      return 0;
+    }
+    return extnode(ip, 0, x);
+  }
+
+  bp = bread(ip->dev, last->start);
+  eb = (struct extentblk*)bp->data;
+  b = extappend(ip, &eb->h, eb->e, NEXT, x);
+  if(b == 0)
+    log_write(bp);
+  brelse(bp);
+  if(b == 0)
+    return 0;
+
+  // the child was full; add its new sibling.
+  ix.lblk = x->lblk;
+  ix.start = b;
+  ix.len = 0;
+  if(h->n < max){
+    e[h->n++] = ix;
+    return 0;
+  }
+  return extnode(ip, h->depth, &ix);
+}
+
+// Append extent x to ip's extent tree, after the last one.
+static void
+extinsert(struct inode *ip, struct extent *x)
+{
+  struct extent ix;
+  uint b;
+
+  b = extappend(ip, &ip->ext.h, ip->ext.e, NIEXT, x);
+  if(b != 0){
+    // the root is full: move it to a block of its own,
+    // and add the new node next to that.
+    ix.lblk = 0;
+    ix.start = extnode(ip, ip->ext.h.depth, &ip->ext.e[0]);
+    ix.len = 0;
+    if(ip->ext.h.n > 1){
+      struct buf *bp = bread(ip->dev, ix.start);
+      struct extentblk *eb = (struct extentblk*)bp->data;
+      memmove(eb->e, ip->ext.e, ip->ext.h.n * sizeof(struct extent));
+      eb->h.n = ip->ext.h.n;
+      log_write(bp);
+      brelse(bp);
+    }
+    ip->ext.h.depth++;
+    ip->ext.h.n = 2;
+    ip->ext.e[0] = ix;
+    ip->ext.e[1].lblk = x->lblk;
+    ip->ext.e[1].start = b;
+    ip->ext.e[1].len = 0;
+  }
+  // the caller updates the inode, holding the root.
+}
+
+// Find ip's last extent. Returns 0 if it has none.
+static int
+extlast(struct inode *ip, struct extent *last)
+{
+  struct extenthdr *h = &ip->ext.h;
+  struct extent *e = ip->ext.e;
+  struct extentblk *eb;
+  struct buf *bp, *child;
+
+  if(h->n == 0)
+    return 0;
+  bp = 0;
+  while(h->depth > 0){
+    child = bread(ip->dev, e[h->n - 1].start);
+    if(bp)
+      brelse(bp);
+    bp = child;
+    eb = (struct extentblk*)bp->data;
+    h = &eb->h;
+    e = eb->e;
+  }
+  *last = e[h->n - 1];
+  if(bp)
+    brelse(bp);
+  return 1;
+}
+
+// Map ip's file blocks up to nblocks, allocating the missing
+// ones in as few runs of contiguous blocks as possible, each
+// continuing on from the last extent if there's room.
+static void
+extgrow(struct inode *ip, uint nblocks)
+{
+  struct extent last, x;
+  uint next, goal;
+
+  next = 0;
+  goal = bgoal(ip);
+  if(extlast(ip, &last)){
+    next = last.lblk + last.len;
+    goal = last.start + last.len;
+  }
+  while(next < nblocks){
+    x.lblk = next;
+    x.start = balloc_range(ip->dev, goal, nblocks - next, &x.len, ip->type == T_FILE);
+    extinsert(ip, &x);
+    next += x.len;
+    goal = x.start + x.len;
+  }
+}
+
+// Return the disk block of file block bn of ip, which uses
+// extents, allocating it if it's past the last one.
+static uint
+extmap(struct inode *ip, uint bn)
+{
+  uint addr;
+
+  if((addr = extlookup(ip, bn)) == 0){
+    extgrow(ip, bn + 1);
+    addr = extlookup(ip, bn);
+  }
+  return addr;
+}
+
+// Free the blocks of the extent tree node (h, e), and the
+// nodes below it.
+static void
+extfree(struct inode *ip, struct extenthdr *h, struct extent *e)
+{
+  struct extentblk *eb;
+  struct buf *bp;
+  int i;
+
+  for(i = 0; i < h->n; i++){
+    if(h->depth == 0){
+      bfree_range(ip->dev, e[i].start, e[i].len);
+      continue;
+    }
+    bp = bread(ip->dev, e[i].start);
+    eb = (struct extentblk*)bp->data;
+    extfree(ip, &eb->h, eb->e);
+    brelse(bp);
+    bfree(ip->dev, e[i].start);
+  }
+}
+
+// Return the disk block address of the nth block in inode ip.
+// If there is no such block, bmap allocates one.
+static uint
+bmap(struct inode *ip, uint bn)
+{
+  uint addr, *a, n, fbn;
+  int level;
+  struct buf *bp;
+
+  if(ip->flags & I_INLINE)
+    panic("bmap: inline");
+  if(ip->flags & I_EXTENTS)
+    return extmap(ip, bn);
+
+  if(bn < NDIRECT){
+    if((addr = ip->addrs[bn]) == 0)
+      ip->addrs[bn] = addr = balloc(ip->dev, bgoal(ip), ip->type == T_FILE);
+    return addr;
+  }
+  if((addr = bmcached(ip, bn)) != 0)
+    return addr;
+  fbn = bn;
+  bn -= NDIRECT;
+
+  // Find the tree holding bn; the one with level
+  // levels of indirect blocks maps n blocks.
+  n = NINDIRECT;
+  for(level = 1; bn >= n; level++){
+    if(level == NLEVEL)
+      panic("bmap: out of range");
+    bn -= n;
+    n *= NINDIRECT;
+  }
+
+  // Walk down it, allocating indirect blocks if necessary.
+  if((addr = ip->addrs[NDIRECT+level-1]) == 0)
+    ip->addrs[NDIRECT+level-1] = addr = balloc(ip->dev, bgoal(ip), 0);
+  for(; level > 0; level--){
+    n /= NINDIRECT;  // blocks mapped by each entry
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / n]) == 0){
+      a[bn / n] = addr = balloc(ip->dev, bgoal(ip), level == 1 && ip->type == T_FILE);
       log_write(bp);
     }
+    if(level == 1)
+      bmrun(ip, a, bn, fbn);
     brelse(bp);
-    return addr;
+    bn %= n;
+  }
+  return addr;
+}
+
+// Free indirect block addr, and the blocks it maps
+// level-1 levels of indirection further down.
+static void
+bfreeind(int dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      bfreeind(dev, a[j], level-1);
+    else
+      bfree(dev, a[j]);
   }
+  brelse(bp);
+  bfree(dev, addr);
+}
 
-  panic("bmap: out of range");
+// Delayed allocation. writei() doesn't give the blocks it adds
+// to a file (with extents) disk blocks at once. It reserves free
+// blocks for them instead, so that it can fail cleanly if the
+// disk is full, and holds their data in pages of memory: the
+// ip->ndelay blocks from file block ip->dstart, where the extents
+// end, on. iflush() later allocates them all together, so that
+// they are contiguous on disk even if other files grew at the
+// same time, and copies their data into the new blocks. That
+// happens when writei() has NDELAY of them, when the inode
+// leaves the cache, on fsync() and sync(), and before the log
+// flusher commits. Until then the inode on disk only has the
+// blocks it has been given: iupdate() writes a size of at most
+// ip->dstart blocks.
+
+#define DPP (PGSIZE/BSIZE)      // delayed blocks per page
+#define EXTRESERVE (NLEVEL + 1) // blocks iflush() may need for extent nodes
+
+// The data of ip's delayed file block bn.
+static char*
+ddata(struct inode *ip, uint bn)
+{
+  bn -= ip->dstart;
+  return ip->delay[bn / DPP] + (bn % DPP) * BSIZE;
+}
+
+// Give ip disk blocks up to file block end now. Returns -1
+// if there aren't enough free blocks.
+static int
+igrow(struct inode *ip, uint end)
+{
+  struct extent last;
+  uint next;
+
+  next = extlast(ip, &last) ? last.lblk + last.len : 0;
+  if(end <= next)
+    return 0;
+  if(breserve(end - next + EXTRESERVE) < 0)
+    return -1;
+  extgrow(ip, end);
+  bunreserve(end - next + EXTRESERVE);
+  return 0;
+}
+
+// Make ip's file blocks up to end delayed blocks, if they
+// haven't disk blocks yet, reserving free blocks for them.
+// Returns -1 if there aren't enough free blocks.
+static int
+idelay(struct inode *ip, uint end)
+{
+  struct extent last;
+  uint n, extra;
+  char *pg;
+
+  if(ip->ndelay == 0)
+    ip->dstart = extlast(ip, &last) ? last.lblk + last.len : 0;
+  if(end <= ip->dstart + ip->ndelay)
+    return 0;
+  if(end > ip->dstart + NDELAY){
+    iflush(ip);
+    if(end > ip->dstart + NDELAY)
+      return igrow(ip, end);
+  }
+
+  n = end - ip->dstart - ip->ndelay;
+  extra = ip->ndelay == 0 ? EXTRESERVE : 0;
+  if(breserve(n + extra) < 0)
+    return -1;
+  for(; n > 0; n--){
+    if(ip->ndelay % DPP == 0){
+      if((pg = kalloc()) == 0){
+        // no memory to hold them: allocate them all now.
+        bunreserve(n + (ip->ndelay == 0 ? extra : 0));
+        iflush(ip);
+        return igrow(ip, end);
+      }
+      memset(pg, 0, PGSIZE);
+      ip->delay[ip->ndelay / DPP] = pg;
+    }
+    ip->ndelay++;
+  }
+  return 0;
+}
+
+// Free ip's delayed blocks' pages and reservation.
+static void
+idiscard(struct inode *ip)
+{
+  uint i;
+
+  if(ip->ndelay == 0)
+    return;
+  for(i = 0; i < ip->ndelay; i += DPP)
+    kfree(ip->delay[i / DPP]);
+  bunreserve(ip->ndelay + EXTRESERVE);
+  ip->ndelay = 0;
+}
+
+// Allocate disk blocks for ip's delayed blocks, in as few runs
+// as possible, and write their data to them.
+// Caller must hold ip->lock exclusively, inside a transaction.
+void
+iflush(struct inode *ip)
+{
+  struct buf *bp;
+  uint bn;
+
+  if(!holdingsleep(&ip->lock))
+    panic("iflush");
+  if(ip->ndelay == 0)
+    return;
+
+  extgrow(ip, ip->dstart + ip->ndelay);
+  for(bn = ip->dstart; bn < ip->dstart + ip->ndelay; bn++){
+    bp = bnew(ip->dev, extlookup(ip, bn));
+    memmove(bp->data, ddata(ip, bn), BSIZE);
+    log_ordered(bp);
+    brelse(bp);
+  }
+  bn = ip->dstart + ip->ndelay;
+  idiscard(ip);
+  ip->dstart = bn;
+  iupdate(ip);
+}
+
+// Flush the delayed blocks of every cached inode, each in
+// a transaction of its own. Must not be called inside a
+// transaction.
+void
+iflushall(void)
+{
+  struct ichunk *c;
+  struct inode *ip;
+  int id;
+
+  if(bsum.reserved == 0)
+    return;
+  // chunks are only ever added, at the front of the list.
+  acquire(&icache.lock);
+  c = icache.chunks;
+  release(&icache.lock);
+  for(; c; c = c->next){
+    for(ip = c->inode; ip < c->inode+IPC; ip++){
+      // ip->ndelay is read without ip->lock, as a hint.
+      // icache.lock keeps the entry from being recycled
+      // while we look at it.
+      acquire(&icache.lock);
+      id = ihash(ip->dev, ip->inum);
+      acquire(&icache.bucket[id].lock);
+      if(ip->ref == 0 || !ip->valid || ip->ndelay == 0){
+        release(&icache.bucket[id].lock);
+        release(&icache.lock);
+        continue;
+      }
+      ip->ref++;
+      release(&icache.bucket[id].lock);
+      release(&icache.lock);
+
+      begin_op(IPUTBLOCKS);
+      ilock(ip);
+      iflush(ip);
+      iunlock(ip);
+      iput(ip);
+      end_op();
+    }
+  }
 }
 
 // Truncate inode (discard contents).
-// Caller must hold ip->lock.
+// Caller must hold ip->lock exclusively.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(!holdingsleep(&ip->lock))
+    panic("itrunc");
+
+  if(ip->flags & I_INLINE){
+    memset(ip->data, 0, sizeof(ip->data));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  idiscard(ip);
+  bmforget(ip);
+  if(ip->flags & I_EXTENTS){
+    extfree(ip, &ip->ext.h, ip->ext.e);
+    memset(&ip->ext, 0, sizeof(ip->ext));
+    ip->flags = I_INLINE;
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -420,24 +1600,296 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreeind(ip->dev, ip->addrs[NDIRECT+i], i+1);
+      ip->addrs[NDIRECT+i] = 0;
     }
+  }
+
+  ip->flags = I_INLINE;
+  ip->size = 0;
+  iupdate(ip);
+}
+
+// Orphans. Freeing all the blocks of a big file at once can take
+// long, and would need room in the log for every bitmap block it
+// touches, so when the last reference to a big file with no links
+// goes, iput() only lists it as an orphan, in the super block's
+// block (see struct sbblock), and leaves it to the orphan worker.
+// The worker frees each orphan's blocks from the end, a little in
+// each of a series of small transactions, and in the last one
+// frees the inode and takes it off the list. Since every step
+// leaves a consistent file system, and the list is on disk, after
+// a crash the worker just carries on from where it had got to.
+// open(O_TRUNC) of a big file hands its blocks to a new orphan
+// the same way.
+
+#define ORPHANMIN 64  // files bigger than this many blocks become orphans
+
+// log blocks each step of freeing a file with extents writes:
+// inode, inode bitmap, orphan list, data bitmap, and an extent
+// node and its bitmap for each level of the tree.
+#define TRUNCBLOCKS (4 + 2*NLEVEL)
+
+static void orphanworker(void);
+
+// Count the orphans left by a crash, and start the worker.
+static void
+orphaninit(int dev)
+{
+  struct buf *bp;
+  struct sbblock *sbb;
+  int i;
+
+  initlock(&orphans.lock, "orphans");
+  orphans.dev = dev;
+  bp = bread(dev, 1);
+  sbb = (struct sbblock*)bp->data;
+  for(i = 0; i < NORPHAN; i++){
+    if(sbb->orphan[i] != 0)
+      orphans.n++;
+  }
+  brelse(bp);
+  kthread("orphan", orphanworker);
+}
+
+// Should freeing ip be left to the orphan worker?
+static int
+ibig(struct inode *ip)
+{
+  return ip->type == T_FILE && ip->size > ORPHANMIN*BSIZE;
+}
+
+// Promise a slot on the orphan list to a later iorphan(ip, 1).
+// Returns -1 if the list has no room.
+static int
+orphanhold(void)
+{
+  int r;
+
+  acquire(&orphans.lock);
+  r = orphans.n + orphans.nheld < NORPHAN ? 0 : -1;
+  if(r == 0)
+    orphans.nheld++;
+  release(&orphans.lock);
+  return r;
+}
+
+// Add ip, which has no links, to the orphan list, in the
+// caller's transaction, using a slot from orphanhold() if held.
+// Does nothing if ip is listed already. Returns -1 if the list
+// is full.
+static int
+iorphan(struct inode *ip, int held)
+{
+  struct buf *bp;
+  struct sbblock *sbb;
+  int i;
+
+  bp = bread(ip->dev, 1);
+  sbb = (struct sbblock*)bp->data;
+  for(i = 0; i < NORPHAN && sbb->orphan[i] != ip->inum; i++)
+    ;
+  acquire(&orphans.lock);
+  if(held)
+    orphans.nheld--;
+  if(i < NORPHAN || (!held && orphans.n + orphans.nheld == NORPHAN)){
+    release(&orphans.lock);
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    return i < NORPHAN ? 0 : -1;
   }
+  for(i = 0; i < NORPHAN && sbb->orphan[i] != 0; i++)
+    ;
+  if(i == NORPHAN)
+    panic("iorphan");
+  sbb->orphan[i] = ip->inum;
+  orphans.n++;
+  wakeup(&orphans);
+  release(&orphans.lock);
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
+// Take inode inum off the orphan list.
+static void
+iunorphan(uint dev, uint inum)
+{
+  struct buf *bp;
+  struct sbblock *sbb;
+  int i;
+
+  bp = bread(dev, 1);
+  sbb = (struct sbblock*)bp->data;
+  for(i = 0; i < NORPHAN && sbb->orphan[i] != inum; i++)
+    ;
+  if(i == NORPHAN)
+    panic("iunorphan");
+  sbb->orphan[i] = 0;
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&orphans.lock);
+  orphans.n--;
+  release(&orphans.lock);
+}
 
+// Free the last blocks of the extent subtree with root node
+// (h, e): the end of its last extent, as far back as the start
+// of the block group that its last block is in, and any nodes
+// that leaves empty. Returns 1 if (h, e) is now empty.
+// Caller logs (h, e) if it returns 0.
+static int
+extchop(struct inode *ip, struct extenthdr *h, struct extent *e)
+{
+  struct extentblk *eb;
+  struct extent *last;
+  struct buf *bp;
+  uint end, from;
+
+  last = &e[h->n - 1];
+  if(h->depth == 0){
+    end = last->start + last->len;
+    from = GSTART(BGROUP(end - 1, sb), sb);
+    if(from < last->start)
+      from = last->start;
+    bfree_range(ip->dev, from, end - from);
+    last->len -= end - from;
+    if(last->len == 0)
+      h->n--;
+    return h->n == 0;
+  }
+
+  bp = bread(ip->dev, last->start);
+  eb = (struct extentblk*)bp->data;
+  if(extchop(ip, &eb->h, eb->e)){
+    brelse(bp);
+    bfree(ip->dev, last->start);
+    h->n--;
+  } else {
+    log_write(bp);
+    brelse(bp);
+  }
+  return h->n == 0;
+}
+
+// Free some of orphan ip's blocks, from the end. A file without
+// extents is truncated all at once. Returns 1 if it has blocks
+// left. Caller must hold ip->lock exclusively, in a transaction
+// of TRUNCBLOCKS, or IPUTBLOCKS for a file without extents.
+static int
+itruncstep(struct inode *ip)
+{
+  idiscard(ip);
+  bmforget(ip);
+  if(!(ip->flags & I_EXTENTS)){
+    itrunc(ip);
+    return 0;
+  }
+  if(ip->ext.h.n > 0 && extchop(ip, &ip->ext.h, ip->ext.e))
+    memset(&ip->ext, 0, sizeof(ip->ext));
   ip->size = 0;
   iupdate(ip);
+  return ip->ext.h.n > 0;
+}
+
+// Free the orphans on dev, one at a time, each step in a
+// transaction of its own, until there are none left. Must
+// not be called inside a transaction.
+void
+ireap(int dev)
+{
+  struct inode *ip;
+  struct buf *bp;
+  struct sbblock *sbb;
+  uint inum;
+  int i, n, more;
+
+  for(;;){
+    bp = bread(dev, 1);
+    sbb = (struct sbblock*)bp->data;
+    for(i = 0; i < NORPHAN && sbb->orphan[i] == 0; i++)
+      ;
+    inum = i < NORPHAN ? sbb->orphan[i] : 0;
+    brelse(bp);
+    if(inum == 0)
+      return;
+
+    ip = iget(dev, inum);
+    ilock(ip);
+    n = (ip->flags & I_EXTENTS) ? TRUNCBLOCKS : IPUTBLOCKS;
+    iunlock(ip);
+    do {
+      begin_op(n);
+      ilock(ip);
+      more = itruncstep(ip);
+      if(!more){
+        ifreeinode(ip);
+        iunorphan(dev, inum);
+      }
+      iunlock(ip);
+      if(!more)
+        iput(ip);
+      end_op();
+    } while(more);
+  }
+}
+
+// The orphan worker thread.
+static void
+orphanworker(void)
+{
+  for(;;){
+    acquire(&orphans.lock);
+    while(orphans.n == 0)
+      sleep(&orphans, &orphans.lock);
+    release(&orphans.lock);
+    ireap(orphans.dev);
+  }
+}
+
+// Truncate ip, which has links, like itrunc(), but leave
+// freeing the blocks of a big file to the orphan worker:
+// give them to a new inode with no links, which becomes an
+// orphan. Caller must hold ip->lock exclusively, in a
+// transaction with room for creating an inode as well.
+void
+itrunclater(struct inode *ip)
+{
+  struct inode *op;
+  uint size;
+
+  // only make an orphan if the list has room for it, since
+  // freeing op here instead would overrun the transaction.
+  size = ip->ndelay > 0 ? min(ip->size, ip->dstart * BSIZE) : ip->size;
+  if(size <= ORPHANMIN*BSIZE || !(ip->flags & I_EXTENTS) ||
+     isum.total == 0 || orphanhold() < 0){
+    itrunc(ip);
+    return;
+  }
+  op = ialloc(ip->dev, T_FILE, ip->inum);
+  ilock(op);
+  op->nlink = 0;
+  op->size = size;
+  op->flags = I_EXTENTS;
+  memmove(&op->ext, &ip->ext, sizeof(ip->ext));
+  iupdate(op);
+  iorphan(op, 1);
+
+  idiscard(ip);
+  bmforget(ip);
+  memset(&ip->ext, 0, sizeof(ip->ext));
+  ip->flags = I_INLINE;
+  ip->size = 0;
+  iupdate(ip);
+
+  // it's big and listed, so this leaves it to the worker.
+  iunlockput(op);
 }
 
 // Copy stat information from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 void
 stati(struct inode *ip, struct stat *st)
 {
@@ -446,10 +1898,47 @@ stati(struct inode *ip, struct stat *st)
   st->type = ip->type;
   st->nlink = ip->nlink;
   st->size = ip->size;
+  st->blocks = (ip->flags & I_INLINE) ? 0 : (ip->size + BSIZE - 1) / BSIZE;
+}
+
+// Read-ahead. When a read of ip continues where the last one
+// left off, start reading the blocks that follow into the buffer
+// cache without waiting for them. ip->raoff is where the next
+// sequential read would start, ip->rawin is the window in blocks,
+// and ip->raend is the block after the last one read ahead.
+// The window starts at RAMIN blocks and doubles, up to RAMAX,
+// each time the reader has used up half of it; any other read
+// cancels read-ahead until reads are sequential again.
+// The fields are only hints: readers holding ip->lock shared
+// may race to update them.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint next, end, b;
+
+  if(off != ip->raoff){
+    ip->raoff = off + n;
+    ip->rawin = 0;
+    ip->raend = 0;
+    return;
+  }
+  ip->raoff = off + n;
+
+  next = (off + n) / BSIZE;
+  if(ip->raend > next + ip->rawin/2)
+    return;
+  ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  end = min(next + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  if(ip->ndelay > 0)
+    end = min(end, ip->dstart);  // the rest aren't on disk
+  for(b = ip->raend > next ? ip->raend : next; b < end; b++)
+    breadahead(ip->dev, bmap(ip, b));
+  if(end > ip->raend)
+    ip->raend = end;
 }
 
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared or exclusive.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
@@ -463,41 +1952,124 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->flags & I_INLINE){
+    if(either_copyout(user_dst, dst, ip->data + off, n) == -1)
+      return -1;
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->ndelay > 0 && off/BSIZE >= ip->dstart){
+      if(either_copyout(user_dst, dst, ddata(ip, off/BSIZE) + (off % BSIZE), m) == -1)
+        break;
+      continue;
+    }
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       break;
     }
     brelse(bp);
   }
+  if(tot > 0)
+    readahead(ip, off - tot, tot);
   return tot;
 }
 
+// Move the data of inline inode ip, which is about to grow
+// past NINLINE bytes, to a block, and give it extents instead.
+// Returns -1, leaving it inline, if there's no room.
+// Caller must hold ip->lock exclusively.
+static int
+iuninline(struct inode *ip)
+{
+  uchar data[NINLINE];
+  uint n;
+
+  n = ip->size;
+  memmove(data, ip->data, n);
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->flags = (ip->flags & ~I_INLINE) | I_EXTENTS;
+  ip->size = 0;
+  // give the data a disk block now rather than a delayed one,
+  // so a crash before iflush() can't lose what was there.
+  if(n > 0 && (igrow(ip, 1) < 0 || writei(ip, 0, (uint64)data, 0, n) != n)){
+    itrunc(ip);
+    memmove(ip->data, data, n);
+    ip->size = n;
+    iupdate(ip);
+    return -1;
+  }
+  return 0;
+}
+
 // Write data to inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock exclusively.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, end, resv;
   struct buf *bp;
 
+  if(!holdingsleep(&ip->lock))
+    panic("writei");
+
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
+  if(ip->flags & I_INLINE){
+    if(off + n <= NINLINE){
+      if(either_copyin(ip->data + off, user_src, src, n) == -1)
+        return -1;
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      return n;
+    }
+    if(iuninline(ip) < 0)
+      return -1;
+  }
+
+  // a file's new blocks are delayed, see iflush(); allocate
+  // a directory's together, so they're contiguous. A file
+  // without extents reserves the blocks bmap() may allocate,
+  // and its indirect blocks.
+  end = (off + n + BSIZE - 1) / BSIZE;
+  resv = 0;
+  if(ip->flags & I_EXTENTS){
+    if(ip->type != T_FILE){
+      if(igrow(ip, end) < 0)
+        return -1;
+    } else if(idelay(ip, end) < 0)
+      return -1;
+  } else if(end > (ip->size + BSIZE - 1) / BSIZE){
+    resv = end - (ip->size + BSIZE - 1) / BSIZE;
+    resv += resv / NINDIRECT + NLEVEL;
+    if(breserve(resv) < 0)
+      return -1;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(ip->ndelay > 0 && off/BSIZE >= ip->dstart){
+      if(either_copyin(ddata(ip, off/BSIZE) + (off % BSIZE), user_src, src, m) == -1)
+        break;
+      continue;
+    }
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
       brelse(bp);
       break;
     }
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_ordered(bp);  // file data isn't logged
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -509,6 +2081,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     // block to ip->addrs[].
     iupdate(ip);
   }
+  if(resv > 0)
+    bunreserve(resv);
 
   return n;
 }
@@ -521,8 +2095,356 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories, see struct dxhdr in fs.h.
+
+// The path from the root of a hashed directory's index to a
+// leaf: blk[i] is the file block of the node at level i, n[i]
+// the entries in it, and slot[i] the entry followed.
+struct dxpath {
+  int depth;
+  uint blk[DXDEPTH+1];
+  int n[DXDEPTH+1];
+  int slot[DXDEPTH+1];
+  uint leaf;
+};
+
+// FNV-1a hash of a name.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Read file block bn of directory dp.
+static struct buf*
+dxread(struct inode *dp, uint bn)
+{
+  return bread(dp->dev, bmap(dp, bn));
+}
+
+// The header of index node bp, file block bn; its
+// entries follow it.
+static struct dxhdr*
+dxnode(struct buf *bp, uint bn)
+{
+  return (struct dxhdr*)bp->data + (bn == 0 ? 2 : 0);
+}
+
+// Can index node bn hold no more entries?
+static int
+dxfull(uint bn, int n)
+{
+  return n == (bn == 0 ? DXROOT : DXNODE);
+}
+
+// Find the leaf of hashed directory dp for names with hash h.
+static void
+dxwalk(struct inode *dp, uint h, struct dxpath *p)
+{
+  struct buf *bp;
+  struct dxhdr *hd;
+  struct dxentry *e;
+  uint bn;
+  int lvl, lo, hi, mid;
+
+  bn = 0;
+  for(lvl = 0; ; lvl++){
+    bp = dxread(dp, bn);
+    hd = dxnode(bp, bn);
+    if(lvl == 0)
+      p->depth = hd->depth;
+    e = (struct dxentry*)(hd + 1);
+    // the last entry whose hash is at most h.
+    lo = 0;
+    hi = hd->n - 1;
+    while(lo < hi){
+      mid = (lo + hi + 1) / 2;
+      if(e[mid].hash <= h)
+        lo = mid;
+      else
+        hi = mid - 1;
+    }
+    p->blk[lvl] = bn;
+    p->n[lvl] = hd->n;
+    p->slot[lvl] = lo;
+    bn = e[lo].block;
+    brelse(bp);
+    if(lvl == p->depth)
+      break;
+  }
+  p->leaf = bn;
+}
+
+// Add a zeroed block to the end of directory dp, and
+// return its file block number, or 0 if there's no room.
+static uint
+dxnew(struct inode *dp)
+{
+  uint bn;
+
+  // the block, and indirect blocks or extent nodes.
+  if(breserve(1 + EXTRESERVE) < 0)
+    return 0;
+  bn = dp->size / BSIZE;
+  bmap(dp, bn);
+  bunreserve(1 + EXTRESERVE);
+  dp->size += BSIZE;
+  iupdate(dp);
+  return bn;
+}
+
+// Insert the entry (hash, block) after entry slot of index
+// node bn, which has room for it.
+static void
+dxinsert(struct inode *dp, uint bn, int slot, uint hash, uint block)
+{
+  struct buf *bp;
+  struct dxhdr *hd;
+  struct dxentry *e;
+
+  bp = dxread(dp, bn);
+  hd = dxnode(bp, bn);
+  e = (struct dxentry*)(hd + 1);
+  memmove(&e[slot+2], &e[slot+1], (hd->n - slot - 1) * sizeof(*e));
+  memset(&e[slot+1], 0, sizeof(*e));
+  e[slot+1].hash = hash;
+  e[slot+1].block = block;
+  hd->n++;
+  log_write(bp);
+  brelse(bp);
+}
+
+// Make room in the full index node at level lvl of path p,
+// whose parent isn't full: split it in two, adding the new
+// half to the parent, or if it's the root, move its entries
+// down into a new node. Returns -1 if the index is as deep
+// as it may be.
+static int
+dxgrow(struct inode *dp, struct dxpath *p, int lvl)
+{
+  struct buf *obp, *nbp;
+  struct dxhdr *oh, *nh;
+  struct dxentry *oe, *ne;
+  uint nb, hash;
+  int half;
+
+  if(lvl == 0 && p->depth == DXDEPTH)
+    return -1;
+  if((nb = dxnew(dp)) == 0)
+    return -1;
+  obp = dxread(dp, p->blk[lvl]);
+  oh = dxnode(obp, p->blk[lvl]);
+  oe = (struct dxentry*)(oh + 1);
+  nbp = dxread(dp, nb);
+  nh = dxnode(nbp, nb);
+  ne = (struct dxentry*)(nh + 1);
+
+  half = lvl == 0 ? 0 : oh->n / 2;
+  nh->n = oh->n - half;
+  memmove(ne, oe + half, nh->n * sizeof(*ne));
+  memset(oe + half, 0, nh->n * sizeof(*oe));
+  oh->n = half;
+  hash = ne[0].hash;
+  if(lvl == 0){
+    oe[0].hash = 0;
+    oe[0].block = nb;
+    oh->n = 1;
+    oh->depth++;
+  }
+  log_write(obp);
+  log_write(nbp);
+  brelse(obp);
+  brelse(nbp);
+
+  if(lvl > 0)
+    dxinsert(dp, p->blk[lvl-1], p->slot[lvl-1], hash, nb);
+  return 0;
+}
+
+// Split the full leaf of path p in two by hash, adding the
+// new one to its parent, which isn't full. Returns -1 if all
+// its names have the same hash.
+static int
+dxsplit(struct inode *dp, struct dxpath *p)
+{
+  struct buf *obp, *nbp;
+  struct dirent *od, *nd;
+  uint hash[BSIZE/sizeof(struct dirent)], sorted[BSIZE/sizeof(struct dirent)];
+  uint nb, s, t;
+  int i, j, k, n;
+
+  n = BSIZE/sizeof(struct dirent);
+  obp = dxread(dp, p->leaf);
+  od = (struct dirent*)obp->data;
+  for(i = 0; i < n; i++){
+    hash[i] = dxhash(od[i].name);
+    t = hash[i];
+    for(j = i; j > 0 && sorted[j-1] > t; j--)
+      sorted[j] = sorted[j-1];
+    sorted[j] = t;
+  }
+
+  // split at the boundary between hashes nearest the middle,
+  // so that names with the same hash stay in one leaf.
+  for(k = 0; k < n/2; k++){
+    if(sorted[n/2 + k] != sorted[n/2 + k - 1]){
+      s = sorted[n/2 + k];
+      break;
+    }
+    if(sorted[n/2 - k] != sorted[n/2 - k - 1]){
+      s = sorted[n/2 - k];
+      break;
+    }
+  }
+  if(k == n/2){
+    brelse(obp);
+    return -1;
+  }
+
+  if((nb = dxnew(dp)) == 0){
+    brelse(obp);
+    return -1;
+  }
+  nbp = dxread(dp, nb);
+  nd = (struct dirent*)nbp->data;
+  for(i = 0, j = 0; i < n; i++){
+    if(hash[i] >= s){
+      nd[j++] = od[i];
+      memset(&od[i], 0, sizeof(od[i]));
+    }
+  }
+  log_write(obp);
+  log_write(nbp);
+  brelse(obp);
+  brelse(nbp);
+
+  dxinsert(dp, p->blk[p->depth], p->slot[p->depth], s, nb);
+  return 0;
+}
+
+// Look for a directory entry in hashed directory dp.
+static struct inode*
+dxlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct dxpath p;
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+  int i;
+
+  // "." and ".." are the first entries of block 0, the root of
+  // the index, not in a leaf.
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    i = name[1] == '.';
+    bp = dxread(dp, 0);
+    de = (struct dirent*)bp->data;
+    inum = de[i].inum;
+    brelse(bp);
+    if(poff)
+      *poff = i*sizeof(*de);
+    return iget(dp->dev, inum);
+  }
+
+  dxwalk(dp, dxhash(name), &p);
+  bp = dxread(dp, p.leaf);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < BSIZE/sizeof(*de); i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      if(poff)
+        *poff = p.leaf*BSIZE + i*sizeof(*de);
+      inum = de[i].inum;
+      brelse(bp);
+      return iget(dp->dev, inum);
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Write a new directory entry (name, inum) into hashed
+// directory dp, which doesn't have name.
+static int
+dxlink(struct inode *dp, char *name, uint inum)
+{
+  struct dxpath p;
+  struct buf *bp;
+  struct dirent *de;
+  int i, lvl;
+
+  for(;;){
+    dxwalk(dp, dxhash(name), &p);
+    bp = dxread(dp, p.leaf);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < BSIZE/sizeof(*de); i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    brelse(bp);
+
+    // the leaf is full. if its parent is full too, make room
+    // in the highest full node on the path first, and retry.
+    for(lvl = p.depth; lvl >= 0 && dxfull(p.blk[lvl], p.n[lvl]); lvl--)
+      ;
+    if(lvl < p.depth){
+      if(dxgrow(dp, &p, lvl + 1) < 0)
+        return -1;
+    } else if(dxsplit(dp, &p) < 0){
+      return -1;
+    }
+  }
+}
+
+// Make the one-block directory dp, which is full, a hashed
+// directory, with all its names in one leaf. Returns -1 if
+// there's no room.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *rbp, *lbp;
+  struct dirent *rd, *ld;
+  struct dxhdr *hd;
+  struct dxentry *e;
+  uint nb;
+
+  if((nb = dxnew(dp)) == 0)
+    return -1;
+  rbp = dxread(dp, 0);
+  lbp = dxread(dp, nb);
+  rd = (struct dirent*)rbp->data;
+  ld = (struct dirent*)lbp->data;
+  memmove(ld + 2, rd + 2, BSIZE - 2*sizeof(*rd));
+  memset(rd + 2, 0, BSIZE - 2*sizeof(*rd));
+  hd = dxnode(rbp, 0);
+  hd->n = 1;
+  hd->depth = 0;
+  e = (struct dxentry*)(hd + 1);
+  e[0].hash = 0;
+  e[0].block = nb;
+  log_write(rbp);
+  log_write(lbp);
+  brelse(rbp);
+  brelse(lbp);
+  dp->flags |= I_HASHED;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared or exclusive.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
@@ -532,6 +2454,16 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  // the dentry cache knows the inode number, but not the offset.
+  if(poff == 0 && dlookup(dp, name, &inum))
+    return inum ? iget(dp->dev, inum) : 0;
+
+  if(dp->flags & I_HASHED){
+    struct inode *ip = dxlookup(dp, name, poff);
+    dinsert(dp, name, ip ? ip->inum : 0);
+    return ip;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -542,19 +2474,22 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dinsert(dp, name, inum);
       return iget(dp->dev, inum);
     }
   }
 
+  dinsert(dp, name, 0);
   return 0;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// A directory that would grow past one block becomes hashed.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
   int off;
-  struct dirent de;
+  struct dirent de, de1;
   struct inode *ip;
 
   // Check that name is not present.
@@ -563,6 +2498,13 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->flags & I_HASHED){
+    if(dxlink(dp, name, inum) < 0)
+      return -1;
+    dinsert(dp, name, inum);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -571,10 +2513,22 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  if(off == BSIZE && dp->size == BSIZE){
+    readi(dp, 0, (uint64)&de, 0, sizeof(de));
+    readi(dp, 0, (uint64)&de1, sizeof(de), sizeof(de1));
+    if(namecmp(de.name, ".") == 0 && namecmp(de1.name, "..") == 0){
+      if(dxconvert(dp) < 0 || dxlink(dp, name, inum) < 0)
+        return -1;
+      dinsert(dp, name, inum);
+      return 0;
+    }
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+    return -1;  // no room to grow the directory
+  dinsert(dp, name, inum);
 
   return 0;
 }
@@ -633,21 +2587,24 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilock_shared(ip);
     if(ip->type != T_DIR){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
     if(nameiparent && *path == '\0'){
       // Stop one level early.
-      iunlock(ip);
+      iunlock_shared(ip);
       return ip;
     }
     if((next = dirlookup(ip, name, 0)) == 0){
-      iunlockput(ip);
+      iunlock_shared(ip);
+      iput(ip);
       return 0;
     }
-    iunlockput(ip);
+    iunlock_shared(ip);
+    iput(ip);
     ip = next;
   }
   if(nameiparent){
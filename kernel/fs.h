@@ -6,8 +6,12 @@
 #define BSIZE 1024  // block size
 
 // Disk layout:
-// [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+// [ boot block | super block | log | block group 0 | block group 1 | ... ]
+//
+// Each block group is BPG blocks (the last may be shorter), and
+// has its own share of the inodes, so that a file's inode, its
+// data and its directory can be kept close together:
+// [ inode bit map | free bit map | inode blocks | data blocks ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -18,15 +22,75 @@ struct superblock {
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
   uint logstart;     // Block number of first log block
-  uint inodestart;   // Block number of first inode block
-  uint bmapstart;    // Block number of first free map block
+  uint gstart;       // Block number of first block group
+  uint ngroups;      // Number of block groups
+  uint ipg;          // Inodes per group, a multiple of IPB
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// The rest of the super block's block lists orphans: inodes
+// with no links whose blocks are being freed in the background,
+// so that after a crash the freeing can be finished. An
+// unused slot is 0.
+#define NORPHAN ((BSIZE - sizeof(struct superblock)) / sizeof(uint))
+
+struct sbblock {
+  struct superblock sb;
+  uint orphan[NORPHAN];
+};
+
+// A file's first NDIRECT blocks are listed in addrs[]. The
+// next NINDIRECT are listed in the indirect block addrs[NDIRECT],
+// the next NINDIRECT^2 through the double-indirect block
+// addrs[NDIRECT+1], and the rest through the triple-indirect
+// block addrs[NDIRECT+2]. (The size is a uint, so no file can
+// actually grow past 4 GB.)
+#define NDIRECT 10
+#define NLEVEL 3    // levels of indirection
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NINDIRECT*NINDIRECT + \
+                 NINDIRECT*NINDIRECT*NINDIRECT)
+
+// Alternatively, if I_EXTENTS is set in its flags, a file's
+// blocks are mapped by a tree of extents, each a run of
+// contiguous blocks. The root node is in the inode, and the
+// rest in extent blocks. In a leaf node (depth 0) the entries
+// are extents; in an interior node, entry i's start is the
+// node holding the file's blocks from lblk up to entry i+1's.
+struct extent {
+  uint lblk;    // First file block it maps
+  uint start;   // First disk block, or child node if depth > 0
+  uint len;     // Number of blocks (leaves only)
+};
+
+struct extenthdr {
+  ushort n;     // Entries in use
+  ushort depth; // Height of the node above the leaves
+};
+
+#define NIEXT 9     // entries in the root node, in the inode
+#define NEXT  ((BSIZE - sizeof(struct extenthdr)) / sizeof(struct extent))
+
+struct extentroot {
+  struct extenthdr h;
+  struct extent e[NIEXT];
+};
+
+// An extent block.
+struct extentblk {
+  struct extenthdr h;
+  struct extent e[NEXT];
+};
+
+// Inode flags
+#define I_EXTENTS 0x1   // blocks are mapped by extents, not addrs[]
+#define I_HASHED  0x2   // directory is indexed by name hash
+#define I_INLINE  0x4   // data is kept in the inode itself
+
+// Bytes of data a file can keep in its inode, in place of
+// addrs[] or the extent root, before it needs blocks.
+#define NINLINE       sizeof(struct extentroot)
 
 // On-disk inode structure
 struct dinode {
@@ -35,20 +99,41 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint flags;           // I_EXTENTS, I_HASHED, I_INLINE
+  union {
+    uint addrs[NDIRECT+NLEVEL];   // Data block addresses
+    struct extentroot ext;        // Or the root of its extent tree
+    uchar data[NINLINE];          // Or the data itself
+  };
 };
 
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
-// Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
-
 // Bitmap bits per block
 #define BPB           (BSIZE*8)
 
-// Block of free map containing bit for block b
-#define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
+// Blocks per group, so that one bitmap block maps a group.
+#define BPG           BPB
+
+// Group holding block b, and inode i
+#define BGROUP(b, sb) (((b) - sb.gstart) / BPG)
+#define IGROUP(i, sb) ((i) / sb.ipg)
+
+// First block of group g, and its first data block
+#define GSTART(g, sb) (sb.gstart + (g) * BPG)
+#define GDATA(g, sb)  (GSTART(g, sb) + 2 + sb.ipg / IPB)
+
+// Block containing inode i
+#define IBLOCK(i, sb)     (GSTART(IGROUP(i, sb), sb) + 2 + (i) % sb.ipg / IPB)
+
+// Block of free map containing bit for block b, and the bit
+#define BBLOCK(b, sb) (GSTART(BGROUP(b, sb), sb) + 1)
+#define BBIT(b, sb)   (((b) - sb.gstart) % BPG)
+
+// Block of inode bitmap containing bit for inode i, and the bit
+#define IMBLOCK(i, sb) GSTART(IGROUP(i, sb), sb)
+#define IMBIT(i, sb)   ((i) % sb.ipg)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -58,3 +143,31 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory that outgrows one block is hashed (I_HASHED).
+// Block 0 holds "." and "..", then the root of an index of
+// the other blocks by the hashes of the names in them. Each
+// index node holds entries sorted by hash, and entry i leads
+// to the names whose hashes are from its hash up to entry
+// i+1's. Below the root are depth levels of index nodes, and
+// then the leaves: blocks of dirents. Index slots are the size of a
+// dirent and start with a zero inum, so to code that reads a
+// directory as dirents they look unused.
+struct dxhdr {
+  ushort zero;
+  ushort n;      // Entries that follow
+  ushort depth;  // Levels of index nodes below (root only)
+  ushort pad[5];
+};
+
+struct dxentry {
+  ushort zero;
+  ushort pad;
+  uint hash;     // Least hash of the names it leads to
+  uint block;    // File block of the index node or leaf
+  uint pad2;
+};
+
+#define DXROOT  (BSIZE / sizeof(struct dirent) - 3)  // after ".", ".." and header
+#define DXNODE  (BSIZE / sizeof(struct dirent) - 1)
+#define DXDEPTH 2  // max levels of index nodes below the root
+
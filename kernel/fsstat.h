@@ -0,0 +1,25 @@
+// File system statistics, as copied out by fsstat().
+struct fsstat {
+  uint64 bhit;       // Buffer cache lookups that found the block.
+  uint64 bmiss;      // Buffer cache lookups that didn't.
+  uint64 rahead;     // Blocks read ahead.
+  uint64 nbuf;       // Buffers currently in the cache.
+  uint64 maxbuf;     // Buffers the cache may grow to.
+  uint64 ncommit;    // Log commits.
+  uint64 nbatched;   // Commits avoided by delaying them.
+  uint64 nordered;   // File data blocks written in place, not logged.
+  uint64 nfree;      // Free disk blocks.
+  uint64 nreserved;  // Of those, reserved for delayed allocation.
+  uint64 nifree;     // Free inodes.
+  uint64 norphan;    // Inodes with no links still being freed.
+  uint64 ihit;       // Inode cache lookups that found the inode.
+  uint64 imiss;      // Inode cache lookups that didn't.
+  uint64 ninode;     // Inodes currently in the cache.
+  uint64 niupdate;   // Changes to inodes, by iupdate().
+  uint64 niwrite;    // Inodes copied to their blocks for a commit.
+  uint64 dhit;       // Name lookups found in the dentry cache.
+  uint64 dmiss;      // Name lookups that weren't.
+  uint64 ndiskreq;   // Disk requests.
+  uint64 nseek;      // Requests not for the block after the last one.
+  uint64 seekdist;   // Total blocks between such requests.
+};
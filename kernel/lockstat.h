@@ -0,0 +1,8 @@
+// Spinlock contention statistics, as copied out by lockstat().
+struct lockstat {
+  char name[16];     // Name of lock.
+  uint64 nacquire;   // Number of acquisitions.
+  uint64 ncontended; // Acquisitions that had to spin.
+  uint64 nspin;      // Total spin iterations.
+  uint64 maxhold;    // Longest hold, in time-CSR cycles.
+};
@@ -6,50 +6,126 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "fsstat.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op(n) reserves log space for the
+// at most n blocks the call will write. Usually it just adds
+// to the count of in-progress FS system calls and to the
+// reserved space, and returns. But if the reservation doesn't
+// fit in the log, it sleeps until the last outstanding
+// end_op() commits.
+//
+// To batch the updates of many small system calls into one
+// commit, the last end_op() doesn't commit right away unless
+// the log is nearly full or someone called log_force(). The
+// log flusher thread commits a transaction once it has been
+// open for COMMITDELAY ticks.
+//
+// The log is double-buffered, so that FS system calls can go on
+// while a transaction commits. Closing a transaction copies the
+// inodes it changed into their blocks (see iupdate() in fs.c), and
+// its blocks from the buffer cache into the cached blocks of one of
+// two log regions, which takes no disk I/O; only then do new
+// system calls have to wait. After that, the next transaction
+// accumulates in memory while the closed one is written to its
+// region. Transactions commit in order, one at a time, and each
+// alternates regions, so a transaction can be closed while the
+// one before it is still committing.
+//
+// Only metadata -- inode, bitmap, indirect and directory blocks --
+// goes through the log. File data blocks are "ordered": log_ordered()
+// records them with the open transaction, and commit() writes them
+// to their home locations before the transaction's log blocks, so
+// that once metadata pointing at them is committed they hold the
+// data. A block freed by a transaction isn't reused until that
+// transaction is installed: otherwise data written in place could
+// land on a block that the committed metadata, or the log, still
+// says belongs to something else.
+//
+// A transaction is done once its header is on disk. The log
+// checkpoint thread then installs it from its region in the
+// background, and frees the region for reuse. Until then its
+// blocks stay pinned in the buffer cache. If both regions are
+// waiting to be installed, an FS system call that needs one
+// installs the older transaction itself.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+// The on-disk log format is two regions, each:
+//   header block, containing a sequence number and
+//     block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous. Recovery replays the committed
+// regions in sequence order.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
+  uint seq;
   int block[LOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks in each region, including the header.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they have reserved.
+  int closing;     // copying the open transaction; please wait.
   int committing;  // in commit(), please wait.
+  int installing;  // in checkpoint(), please wait.
+  int pending;     // closed transactions not yet installed.
+  int ckpt;        // region to install next.
+  int forced;      // log_force() is waiting; commit at once.
+  uint opened;     // ticks when the open transaction logged its first block.
   int dev;
+  int cur;         // region the open transaction will be copied to.
+  uint seq;        // sequence number of the open transaction.
+  uint done;       // sequence number of the last committed one.
   struct logheader lh;
+  struct buf *home[LOGSIZE]; // lh's pinned buffers
+  int nord;
+  struct buf *ord[NORDERED]; // pinned file data blocks to write in place
+  uchar *freed;    // bitmap of blocks freed by the open transaction
+  int nfreed;
+
+  // closed transactions, by region.
+  struct {
+    struct logheader lh;
+    int committed;              // header is on disk; install me
+    struct buf *home[LOGSIZE];  // pinned cached blocks
+    struct buf *copy[LOGSIZE];  // pinned log blocks holding their copies
+    int nord;
+    struct buf *ord[NORDERED];  // pinned file data blocks
+    uchar *freed;               // blocks it freed
+    int nfreed;
+  } region[2];
+  uchar freedmap[3][FSSIZE/8+1]; // for freed and the regions' freed
+
+  uint64 ncommit;  // commits so far
+  uint64 nbatched; // end_op()s that left the commit for later
+  uint64 nordered; // file data blocks written in place
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(int);
+static void checkpoint(int);
+static void logflusher(void);
+static void logcheckpointer(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -59,54 +135,81 @@ initlog(int dev, struct superblock *sb)
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
-  log.size = sb->nlog;
+  log.size = sb->nlog / 2;
   log.dev = dev;
+  log.freed = log.freedmap[0];
+  log.region[0].freed = log.freedmap[1];
+  log.region[1].freed = log.freedmap[2];
   recover_from_log();
+  kthread("logflush", logflusher);
+  kthread("logckpt", logcheckpointer);
+}
+
+// Block number of the header of region r.
+static int
+regionstart(int r)
+{
+  return log.start + r*log.size;
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from region r of the log to their
+// home location. When recovering, nothing else uses the
+// cache, and the home blocks are updated through it. Otherwise
+// the cached home blocks may already hold changes of a later
+// transaction, so the region's copies are written home
+// directly, leaving the cache alone.
 static void
-install_trans(void)
+install_trans(int r, int recovering)
 {
+  struct logheader *lh = &log.region[r].lh;
+  struct buf ib;
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    bunpin(dbuf);
+  for (tail = 0; tail < lh->n; tail++) {
+    struct buf *lbuf = bread(log.dev, regionstart(r)+tail+1); // read log block
+    if(recovering){
+      struct buf *dbuf = bread(log.dev, lh->block[tail]); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(dbuf);
+    } else {
+      ib.dev = log.dev;
+      ib.blockno = lh->block[tail];
+      ib.data = lbuf->data;
+      virtio_disk_rw(&ib, 1);  // write dst to disk
+    }
     brelse(lbuf);
-    brelse(dbuf);
   }
 }
 
-// Read the log header from disk into the in-memory log header
+// Read region r's log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(int r)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(log.dev, regionstart(r));
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.region[r].lh.n = lh->n;
+  log.region[r].lh.seq = lh->seq;
+  for (i = 0; i < lh->n; i++) {
+    log.region[r].lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write region r's in-memory log header to disk.
 // This is the true point at which the
-// current transaction commits.
+// region's transaction commits.
 static void
-write_head(void)
+write_head(int r)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bnew(log.dev, regionstart(r));
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.region[r].lh.n;
+  hb->seq = log.region[r].lh.seq;
+  for (i = 0; i < hb->n; i++) {
+    hb->block[i] = log.region[r].lh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -115,25 +218,170 @@ write_head(void)
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
+  int r, first;
+
+  read_head(0);
+  read_head(1);
+
+  // if committed, copy from log to disk, oldest first
+  first = log.region[1].lh.n > 0 &&
+    (log.region[0].lh.n == 0 || log.region[1].lh.seq < log.region[0].lh.seq);
+  for(r = first; r < first+2; r++)
+    install_trans(r % 2, 1);
+
+  log.seq = log.region[0].lh.seq;
+  if(log.region[1].lh.seq > log.seq)
+    log.seq = log.region[1].lh.seq;
+  log.done = log.seq;
+  log.seq++;
+
+  // clear the log
+  for(r = 0; r < 2; r++){
+    log.region[r].lh.n = 0;
+    write_head(r);
+  }
+}
+
+// Copy the open transaction's blocks into the cached blocks
+// of region r, and pin those until commit() has written them.
+static void
+snapshot(int r)
+{
+  int tail;
+
+  for (tail = 0; tail < log.region[r].lh.n; tail++) {
+    struct buf *to = bnew(log.dev, regionstart(r)+tail+1); // log block
+    struct buf *from = bread(log.dev, log.region[r].lh.block[tail]); // cache block
+    memmove(to->data, from->data, BSIZE);
+    bpin(to);
+    log.region[r].copy[tail] = to;
+    brelse(from);
+    brelse(to);
+  }
+}
+
+// Can the open transaction be closed now?
+static int
+canclose(void)
+{
+  return log.lh.n > 0 && log.outstanding == 0 &&
+    !log.closing && log.pending < 2;
+}
+
+// Close the open transaction and commit it. Caller holds
+// log.lock, and canclose() must be true. Releases log.lock
+// while copying and writing, since not allowed to sleep with
+// locks, and lets new FS system calls start once the
+// transaction is closed.
+static void
+docommit(void)
+{
+  uchar *freed;
+  int r, i;
+
+  r = log.cur;
+  log.region[r].lh = log.lh;
+  log.region[r].lh.seq = log.seq;
+  for(i = 0; i < log.lh.n; i++)
+    log.region[r].home[i] = log.home[i];
+  log.region[r].nord = log.nord;
+  for(i = 0; i < log.nord; i++)
+    log.region[r].ord[i] = log.ord[i];
+  log.nord = 0;
+  // the region's freed map was cleared when it was installed.
+  freed = log.region[r].freed;
+  log.region[r].freed = log.freed;
+  log.region[r].nfreed = log.nfreed;
+  log.freed = freed;
+  log.nfreed = 0;
+  log.closing = 1;
+  log.pending++;
+  log.forced = 0;
+  release(&log.lock);
+  iwritedirty();
+  snapshot(r);
+  acquire(&log.lock);
+  log.closing = 0;
   log.lh.n = 0;
-  write_head(); // clear the log
+  log.cur = 1 - r;
+  log.seq++;
+  wakeup(&log);
+
+  // commit in order, after the transaction before it.
+  while(log.committing)
+    sleep(&log, &log.lock);
+  log.committing = 1;
+  release(&log.lock);
+  commit(r);
+  acquire(&log.lock);
+  log.committing = 0;
+  log.region[r].committed = 1;
+  log.done = log.region[r].lh.seq;
+  log.ncommit++;
+  wakeup(&log);
+  wakeup(&log.installing);
+}
+
+// Is there a committed transaction to install, and
+// nobody installing one?
+static int
+caninstall(void)
+{
+  return !log.installing && log.region[log.ckpt].committed;
+}
+
+// Install the oldest committed transaction, and free its
+// region. Caller holds log.lock, and caninstall() must be
+// true. Releases log.lock while writing.
+static void
+doinstall(void)
+{
+  int r;
+
+  r = log.ckpt;
+  log.installing = 1;
+  release(&log.lock);
+  checkpoint(r);
+  acquire(&log.lock);
+  log.installing = 0;
+  log.region[r].committed = 0;
+  log.ckpt = 1 - r;
+  log.pending--;
+  wakeup(&log);
+}
+
+// Would an operation writing n blocks not fit in the log?
+static int
+logfull(int n)
+{
+  return log.lh.n + log.reserved + n > LOGSIZE;
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call,
+// which will write at most n blocks.
 void
-begin_op(void)
+begin_op(int n)
 {
+  if(n > MAXOPBLOCKS)
+    panic("begin_op: too many blocks");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    if(log.closing){
       sleep(&log, &log.lock);
+    } else if(logfull(n)){
+      // this op might exhaust log space; wait for commit,
+      // or commit now if no op is left to do it.
+      if(canclose())
+        docommit();
+      else if(log.pending == 2 && caninstall())
+        doinstall();
+      else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -141,63 +389,150 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and the commit can't be put off.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    if((COMMITDELAY == 0 || log.forced || logfull(MAXOPBLOCKS) ||
+        log.nord > NORDERED - MAXOPBLOCKS) && canclose())
+      docommit();
+    else if(log.lh.n > 0)
+      log.nbatched++;
   }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+// Commit the open transaction, if any, and wait until it's
+// on disk. Must not be called inside a transaction.
+void
+log_force(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  target = log.lh.n > 0 ? log.seq : log.seq - 1;
+  while(log.done < target){
+    if(log.lh.n > 0 && canclose()){
+      docommit();
+    } else if(log.lh.n > 0 && log.pending == 2 && caninstall()){
+      doinstall();
+    } else {
+      log.forced = 1;
+      sleep(&log, &log.lock);
+    }
+  }
+  release(&log.lock);
+}
+
+// The log flusher thread. Once a tick, gives the blocks
+// whose allocation writei() delayed disk blocks, and commits
+// the open transaction if it has waited COMMITDELAY ticks and
+// no operation is in progress.
+static void
+logflusher(void)
+{
+  acquire(&log.lock);
+  for(;;){
     release(&log.lock);
+    iflushall();
+    acquire(&log.lock);
+    if(canclose() && (log.forced || ticks - log.opened >= COMMITDELAY))
+      docommit();
+    // not holding tickslock, so may miss a tick; that's fine.
+    sleep(&ticks, &log.lock);
+  }
+}
+
+// The log checkpoint thread: installs committed
+// transactions as they come.
+static void
+logcheckpointer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(caninstall())
+      doinstall();
+    else
+      sleep(&log.installing, &log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Fill in the log's part of st.
+void
+logstat(struct fsstat *st)
+{
+  st->ncommit = log.ncommit;
+  st->nbatched = log.nbatched;
+  st->nordered = log.nordered;
+}
+
+// Write region r's file data blocks to their home locations.
+static void
+write_ordered(int r)
+{
+  struct buf *b;
+  int i;
+
+  for (i = 0; i < log.region[r].nord; i++) {
+    b = bread(log.dev, log.region[r].ord[i]->blockno); // already cached
+    bwrite(b);
+    bunpin(b);
+    brelse(b);
+  }
+  __sync_fetch_and_add(&log.nordered, log.region[r].nord);
+  log.region[r].nord = 0;
+}
+
+// Write region r's copies of the blocks to the log.
 static void
-write_log(void)
+write_log(int r)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
+  for (tail = 0; tail < log.region[r].lh.n; tail++) {
+    struct buf *to = bread(log.dev, regionstart(r)+tail+1); // log block
     bwrite(to);  // write the log
-    brelse(from);
     brelse(to);
   }
 }
 
+// Commit the closed transaction in region r.
+static void
+commit(int r)
+{
+  write_ordered(r); // Write file data in place first
+  write_log(r);     // Write the copied blocks to the log
+  write_head(r);    // Write header to disk -- the real commit
+}
+
+// Install the committed transaction in region r.
 static void
-commit()
+checkpoint(int r)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int tail;
+
+  install_trans(r, 0); // Install writes to home locations
+  for (tail = 0; tail < log.region[r].lh.n; tail++) {
+    bunpin(log.region[r].copy[tail]);
+    bunpin(log.region[r].home[tail]);
+  }
+  log.region[r].lh.n = 0;
+  write_head(r);    // Erase the transaction from the log
+  if(log.region[r].nfreed){
+    // its freed blocks may be reused now.
+    bsettle(log.region[r].nfreed);
+    memset(log.region[r].freed, 0, FSSIZE/8+1);
+    log.region[r].nfreed = 0;
   }
 }
 
@@ -228,8 +563,70 @@ log_write(struct buf *b)
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    log.home[i] = b;
+    if(log.lh.n == 0)
+      log.opened = ticks;
     log.lh.n++;
   }
   release(&log.lock);
 }
 
+// Like log_write(), but for a file data block, which commit()
+// will write in place rather than through the log. If the open
+// transaction can't take any more, writes it now, which is
+// also before the transaction commits.
+void
+log_ordered(struct buf *b)
+{
+  int i;
+
+  if (log.outstanding < 1)
+    panic("log_ordered outside of trans");
+
+  acquire(&log.lock);
+  for (i = 0; i < log.nord; i++) {
+    if (log.ord[i] == b){
+      release(&log.lock);
+      return;
+    }
+  }
+  if (log.nord < NORDERED) {
+    bpin(b);
+    log.ord[log.nord++] = b;
+    release(&log.lock);
+    return;
+  }
+  release(&log.lock);
+  bwrite(b);
+  __sync_fetch_and_add(&log.nordered, 1);
+}
+
+// Record that the open transaction freed the n blocks
+// starting at blockno.
+void
+log_free(uint blockno, uint n)
+{
+  uint b;
+
+  acquire(&log.lock);
+  for(b = blockno; b < blockno + n; b++)
+    log.freed[b/8] |= 1 << (b%8);
+  log.nfreed += n;
+  release(&log.lock);
+}
+
+// Was block blockno freed by a transaction that isn't installed
+// yet? If so, it mustn't be allocated again until it is.
+int
+log_busy(uint blockno)
+{
+  int m, busy;
+
+  m = 1 << (blockno%8);
+  acquire(&log.lock);
+  busy = (log.freed[blockno/8] & m) ||
+    (log.region[0].freed[blockno/8] & m) ||
+    (log.region[1].freed[blockno/8] & m);
+  release(&log.lock);
+  return busy;
+}
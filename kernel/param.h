@@ -1,13 +1,22 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NFILE       500  // open files per system
+#define NINODE       50  // initial size of i-node cache, which grows on demand
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  56  // max # of blocks any FS op writes
+#define IPUTBLOCKS   (FSSIZE/(8*1024) + 3 + 7)  // max # of blocks iput() writes: inode, inode bitmap, bitmap, extents
+#define NDELAY       64  // max file blocks per inode waiting for disk blocks
+#define NBMAP         4  // runs of file blocks each inode's block map cache holds
+#define LOGSIZE      128 // max data blocks in on-disk log
+#define NORDERED     (LOGSIZE*4)  // max file data blocks a log transaction writes in place
+#define COMMITDELAY  1     // ticks a log commit may wait, to batch FS ops; 0 to commit at once
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEFRAC   4     // disk block cache may use 1/BCACHEFRAC of free memory
+#define FSSIZE       200000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXTICKETS   1000  // largest share settickets() accepts
+#define RAMIN        4     // initial read-ahead window, in blocks
+#define RAMAX        32    // largest read-ahead window, in blocks
@@ -15,6 +15,17 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Stride scheduling. A process with tickets > 0 belongs to the
+// stride class: it advances its pass by STRIDE1/tickets each time
+// it runs, and the class's turns go to the lowest pass, so CPU
+// time within the class is proportional to tickets.
+// stride_vtime is the pass of the most recently chosen process;
+// processes joining the class start there so that they can't
+// monopolize the CPU with a stale, low pass. It is only a hint
+// and is read and written without a lock.
+#define STRIDE1 (1<<20)
+uint64 stride_vtime;
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
@@ -149,6 +160,10 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->tickets = 0;
+  p->stride = 0;
+  p->pass = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -291,6 +306,11 @@ fork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // the child inherits the parent's scheduling class and share.
+  np->tickets = p->tickets;
+  np->stride = p->stride;
+  np->pass = p->pass;
+
   pid = np->pid;
 
   np->state = RUNNABLE;
@@ -346,7 +366,7 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_op(IPUTBLOCKS);
   iput(p->cwd);
   end_op();
   p->cwd = 0;
@@ -446,6 +466,61 @@ wait(uint64 addr)
   }
 }
 
+// Switch to p, which must be RUNNABLE and locked, and
+// return when it gives up the CPU. Charges a stride-class
+// process for its turn.
+static void
+runproc(struct cpu *c, struct proc *p)
+{
+  // Switch to chosen process.  It is the process's job
+  // to release its lock and then reacquire it
+  // before jumping back to us.
+  p->state = RUNNING;
+  c->proc = p;
+  swtch(&c->context, &p->context);
+
+  // Process is done running for now.
+  // It should have changed its p->state before coming back.
+  c->proc = 0;
+
+  if(p->tickets > 0)
+    p->pass += p->stride;
+}
+
+// Find the RUNNABLE stride-class process with the lowest pass.
+// Returns it locked, or 0 if there is none (or it was taken
+// by another CPU in the meantime).
+// Proc locks are not held across the scan, since holding one
+// while acquiring another could deadlock with wait().
+static struct proc*
+stridepick(void)
+{
+  struct proc *p, *best;
+  uint64 bestpass;
+
+  best = 0;
+  bestpass = 0;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->state == RUNNABLE && p->tickets > 0 &&
+       (best == 0 || p->pass < bestpass)){
+      best = p;
+      bestpass = p->pass;
+    }
+    release(&p->lock);
+  }
+  if(best == 0)
+    return 0;
+
+  acquire(&best->lock);
+  if(best->state != RUNNABLE || best->tickets == 0){
+    release(&best->lock);
+    return 0;
+  }
+  stride_vtime = best->pass;
+  return best;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -453,10 +528,16 @@ wait(uint64 addr)
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// Round-robin processes are taken in proc[] order. Each
+// RUNNABLE stride-class process also gets a slot in the
+// round, but the slot is handed to whichever stride process
+// has the lowest pass, so the class as a whole shares the CPU
+// with round-robin processes while dividing its own share in
+// proportion to tickets.
 void
 scheduler(void)
 {
-  struct proc *p;
+  struct proc *p, *sp;
   struct cpu *c = mycpu();
   
   c->proc = 0;
@@ -467,18 +548,17 @@ scheduler(void)
     int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
+      if(p->state == RUNNABLE && p->tickets > 0) {
+        release(&p->lock);
+        if((sp = stridepick()) != 0){
+          runproc(c, sp);
+          release(&sp->lock);
+          found = 1;
+        }
+        continue;
+      }
       if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
+        runproc(c, p);
         found = 1;
       }
       release(&p->lock);
@@ -549,6 +629,37 @@ forkret(void)
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(), which must never return.
+// It's a process with no user memory, no parent and no cwd,
+// that only ever runs in the kernel.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
@@ -583,6 +694,17 @@ sleep(void *chan, struct spinlock *lk)
   }
 }
 
+// Make sleeping process p runnable. Don't let a long sleep
+// bank CPU time in the stride class.
+// Caller must hold p->lock.
+static void
+stridewake(struct proc *p)
+{
+  p->state = RUNNABLE;
+  if(p->tickets > 0 && p->pass < stride_vtime)
+    p->pass = stride_vtime;
+}
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void
@@ -593,7 +715,7 @@ wakeup(void *chan)
   for(p = proc; p < &proc[NPROC]; p++) {
     acquire(&p->lock);
     if(p->state == SLEEPING && p->chan == chan) {
-      p->state = RUNNABLE;
+      stridewake(p);
     }
     release(&p->lock);
   }
@@ -607,7 +729,7 @@ wakeup1(struct proc *p)
   if(!holding(&p->lock))
     panic("wakeup1");
   if(p->chan == p && p->state == SLEEPING) {
-    p->state = RUNNABLE;
+    stridewake(p);
   }
 }
 
@@ -635,6 +757,25 @@ kill(int pid)
   return -1;
 }
 
+// Put the current process in the stride class with the given
+// share of the CPU, or back in the round-robin class if
+// tickets is 0.
+int
+settickets(int tickets)
+{
+  struct proc *p = myproc();
+
+  if(tickets < 0 || tickets > MAXTICKETS)
+    return -1;
+
+  acquire(&p->lock);
+  p->tickets = tickets;
+  p->stride = tickets > 0 ? STRIDE1 / tickets : 0;
+  p->pass = stride_vtime;
+  release(&p->lock);
+  return 0;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
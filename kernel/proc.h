@@ -18,12 +18,15 @@ struct context {
   uint64 s11;
 };
 
+#define NMCSNODE 8  // max spinlocks one CPU may hold or wait for at once
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct mcsnode mcs[NMCSNODE]; // Queue nodes for MCS spinlocks.
 };
 
 extern struct cpu cpus[NCPU];
@@ -93,6 +96,9 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int tickets;                 // Stride-class share; 0 means round-robin
+  uint64 stride;               // STRIDE1 / tickets
+  uint64 pass;                 // Stride virtual time; lowest runs first
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
@@ -103,4 +109,6 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Kernel thread's function, or 0
+  int logres;                  // Log blocks reserved by begin_op()
 };
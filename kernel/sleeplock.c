@@ -15,16 +15,21 @@ initsleeplock(struct sleeplock *lk, char *name)
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writewait = 0;
   lk->pid = 0;
 }
 
+// Acquire the lock exclusively.
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  lk->writewait++;
+  while (lk->locked || lk->readers > 0) {
     sleep(lk, &lk->lk);
   }
+  lk->writewait--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
   release(&lk->lk);
@@ -40,6 +45,33 @@ releasesleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Acquire the lock shared with other readers.
+// A process must not take the same lock shared twice, since
+// a writer arriving in between would deadlock it.
+void
+acquiresleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->writewait > 0) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+releasesleep_shared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleep_shared");
+  lk->readers--;
+  if(lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Is the current process holding the lock exclusively?
 int
 holdingsleep(struct sleeplock *lk)
 {
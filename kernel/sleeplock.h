@@ -1,10 +1,16 @@
 // Long-term locks for processes
+//
+// A sleeplock can be held exclusively by one process, or shared
+// by any number of readers. Waiting writers hold off new readers
+// so that a stream of readers can't starve them.
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of processes holding it shared.
+  int writewait;     // Number of processes waiting for exclusive.
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
-  int pid;           // Process holding lock
+  int pid;           // Process holding lock exclusively
 };
 
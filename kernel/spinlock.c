@@ -7,30 +7,266 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "lockstat.h"
+
+#define NLOCKCLASS 64  // lock names lockstat() can report
+
+// Registry of initialized locks, for lockstat(): a list through
+// their regnext and regprev, so that it has room for however
+// many buffers, inodes and pipes the caches grow to. Locks that
+// live in memory which is later freed (e.g. pipes) must be
+// removed with freelock() first.
+struct {
+  struct spinlock lock;
+  struct spinlock *head;
+  struct lockstat class[NLOCKCLASS]; // lockstat()'s totals by name
+} lockreg;
+
+static void lockinit(struct spinlock*);
+
+static void
+resetstats(struct spinlock *lk)
+{
+  lk->nacquire = 0;
+  lk->ncontended = 0;
+  lk->nspin = 0;
+  lk->maxhold = 0;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lockinit(lk);
   lk->cpu = 0;
+  resetstats(lk);
+
+  // lockreg.lock is zero-filled, which is a valid unheld lock,
+  // so it can be used before anything else is initialized.
+  acquire(&lockreg.lock);
+  lk->regprev = 0;
+  lk->regnext = lockreg.head;
+  if(lockreg.head)
+    lockreg.head->regprev = lk;
+  lockreg.head = lk;
+  release(&lockreg.lock);
+}
+
+// Remove lk from the registry before its memory is freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lockreg.lock);
+  if(lk->regprev)
+    lk->regprev->regnext = lk->regnext;
+  else
+    lockreg.head = lk->regnext;
+  if(lk->regnext)
+    lk->regnext->regprev = lk->regprev;
+  release(&lockreg.lock);
+}
+
+// Waiters spin with exponential backoff between attempts, so that
+// they don't saturate the lock's cache line and slow down the
+// holder. Delays are in loop iterations.
+#define MINBACKOFF 4
+#define MAXBACKOFF 1024
+
+static void
+backoff(uint *delay)
+{
+  volatile uint i;
+
+  for(i = 0; i < *delay; i++)
+    ;
+  if(*delay < MAXBACKOFF)
+    *delay *= 2;
+}
+
+#if defined(LOCK_TICKET)
+
+static void
+lockinit(struct spinlock *lk)
+{
+  lk->next = 0;
+  lk->owner = 0;
+}
+
+// Take a ticket and wait for it to be served.
+// Returns the number of times we had to wait.
+static uint64
+lockacquire(struct spinlock *lk)
+{
+  uint64 spins = 0;
+  uint delay = MINBACKOFF;
+
+  // On RISC-V, this is an amoadd.w.
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  while(*(volatile uint*)&lk->owner != ticket){
+    spins++;
+    backoff(&delay);
+  }
+  return spins;
+}
+
+static void
+lockrelease(struct spinlock *lk)
+{
+  // Only the holder writes owner, but use an atomic add so
+  // that the store isn't split.
+  __sync_fetch_and_add(&lk->owner, 1);
+}
+
+static int
+lockheld(struct spinlock *lk)
+{
+  return *(volatile uint*)&lk->owner != *(volatile uint*)&lk->next;
+}
+
+#elif defined(LOCK_MCS)
+
+static void
+lockinit(struct spinlock *lk)
+{
+  lk->tail = 0;
+  lk->node = 0;
+}
+
+// Find a free queue node for this CPU. Interrupts are off.
+static struct mcsnode*
+mcsalloc(void)
+{
+  struct cpu *c = mycpu();
+  int i;
+
+  for(i = 0; i < NMCSNODE; i++){
+    if(c->mcs[i].inuse == 0){
+      c->mcs[i].inuse = 1;
+      return &c->mcs[i];
+    }
+  }
+  panic("mcsalloc");
+}
+
+// Append a node to the queue and, unless the lock was free,
+// wait for our predecessor to hand it over. The wait is on our
+// own node, so there's no shared cache line to back off from.
+// Returns the number of spin iterations.
+static uint64
+lockacquire(struct spinlock *lk)
+{
+  struct mcsnode *me, *pred;
+  uint64 spins = 0;
+
+  me = mcsalloc();
+  me->next = 0;
+  me->wait = 1;
+  __sync_synchronize();
+
+  // Atomic swap; on RISC-V, amoswap.d.aq.
+  pred = __sync_lock_test_and_set(&lk->tail, me);
+  if(pred){
+    pred->next = me;
+    while(*(volatile uint*)&me->wait)
+      spins++;
+  }
+  lk->node = me;
+  return spins;
+}
+
+static void
+lockrelease(struct spinlock *lk)
+{
+  struct mcsnode *me, *next;
+  uint delay = MINBACKOFF;
+
+  me = lk->node;
+  lk->node = 0;
+  if(*(struct mcsnode * volatile *)&me->next == 0){
+    // No known successor: try to mark the lock free.
+    if(__sync_bool_compare_and_swap(&lk->tail, me, 0)){
+      me->inuse = 0;
+      return;
+    }
+    // A successor swapped itself in but hasn't linked yet.
+    while(*(struct mcsnode * volatile *)&me->next == 0)
+      backoff(&delay);
+  }
+  next = me->next;
+  __sync_synchronize();
+  next->wait = 0;
+  me->inuse = 0;
+}
+
+static int
+lockheld(struct spinlock *lk)
+{
+  return *(struct mcsnode * volatile *)&lk->tail != 0;
 }
 
+#else
+
+static void
+lockinit(struct spinlock *lk)
+{
+  lk->locked = 0;
+}
+
+// Test-and-test-and-set: only attempt the swap when the
+// lock looks free, and back off after each failed attempt.
+// Returns the number of failed attempts.
+static uint64
+lockacquire(struct spinlock *lk)
+{
+  uint64 spins = 0;
+  uint delay = MINBACKOFF;
+
+  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  //   a5 = 1
+  //   s1 = &lk->locked
+  //   amoswap.w.aq a5, a5, (s1)
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+    spins++;
+    do {
+      backoff(&delay);
+    } while(*(volatile uint*)&lk->locked);
+  }
+  return spins;
+}
+
+static void
+lockrelease(struct spinlock *lk)
+{
+  // Release the lock, equivalent to lk->locked = 0.
+  // This code doesn't use a C assignment, since the C standard
+  // implies that an assignment might be implemented with
+  // multiple store instructions.
+  // On RISC-V, sync_lock_release turns into an atomic swap:
+  //   s1 = &lk->locked
+  //   amoswap.w zero, zero, (s1)
+  __sync_lock_release(&lk->locked);
+}
+
+static int
+lockheld(struct spinlock *lk)
+{
+  return lk->locked;
+}
+
+#endif
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void
 acquire(struct spinlock *lk)
 {
+  uint64 spins;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  spins = lockacquire(lk);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +276,14 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+
+  // We hold the lock, so the statistics need no atomics.
+  lk->nacquire++;
+  if(spins > 0){
+    lk->ncontended++;
+    lk->nspin += spins;
+  }
+  lk->holdstart = r_time();
 }
 
 // Release the lock.
@@ -49,6 +293,10 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  uint64 held = r_time() - lk->holdstart;
+  if(held > lk->maxhold)
+    lk->maxhold = held;
+
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +307,7 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  lockrelease(lk);
 
   pop_off();
 }
@@ -77,7 +318,7 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lockheld(lk) && lk->cpu == mycpu());
   return r;
 }
 
@@ -108,3 +349,75 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Copy statistics for the n most contended kinds of lock to
+// the user array dst, most contended first. Locks with the same
+// name, such as the buffer cache's buckets or the pipes, count
+// as one kind: their statistics are added up, and maxhold is the
+// longest of theirs. Returns the number copied, or -1 on error.
+// The statistics of other locks are read without holding them,
+// so they may be slightly stale.
+int
+lockstat(uint64 dst, int n)
+{
+  struct lockstat *c, *best, *end;
+  struct spinlock *lk;
+  int k;
+
+  acquire(&lockreg.lock);
+  memset(lockreg.class, 0, sizeof(lockreg.class));
+  end = lockreg.class;
+  for(lk = lockreg.head; lk; lk = lk->regnext){
+    if(lk->nacquire == 0)
+      continue;
+    for(c = lockreg.class; c < end; c++){
+      if(strncmp(c->name, lk->name, sizeof(c->name) - 1) == 0)
+        break;
+    }
+    if(c == end){
+      if(end == lockreg.class + NLOCKCLASS)
+        continue;  // too many names; the rest aren't reported
+      safestrcpy(c->name, lk->name, sizeof(c->name));
+      end++;
+    }
+    c->nacquire += lk->nacquire;
+    c->ncontended += lk->ncontended;
+    c->nspin += lk->nspin;
+    if(lk->maxhold > c->maxhold)
+      c->maxhold = lk->maxhold;
+  }
+
+  for(k = 0; k < n; k++){
+    best = 0;
+    for(c = lockreg.class; c < end; c++){
+      if(c->nacquire == 0)  // already copied out
+        continue;
+      if(best == 0 || c->ncontended > best->ncontended ||
+         (c->ncontended == best->ncontended && c->nspin > best->nspin))
+        best = c;
+    }
+    if(best == 0)
+      break;
+    // copyout() doesn't sleep or take locks, so it's safe
+    // to call with lockreg.lock held.
+    if(copyout(myproc()->pagetable, dst + k*sizeof(*best), (char*)best, sizeof(*best)) < 0){
+      release(&lockreg.lock);
+      return -1;
+    }
+    best->nacquire = 0;
+  }
+  release(&lockreg.lock);
+  return k;
+}
+
+// Zero the statistics of every registered lock.
+void
+lockreset(void)
+{
+  struct spinlock *lk;
+
+  acquire(&lockreg.lock);
+  for(lk = lockreg.head; lk; lk = lk->regnext)
+    resetstats(lk);
+  release(&lockreg.lock);
+}
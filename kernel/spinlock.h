@@ -1,9 +1,44 @@
 // Mutual exclusion lock.
+//
+// There are three implementations behind the same interface,
+// chosen at compile time with make LOCK=tas|ticket|mcs:
+//   tas:    test-and-set on a single word (the default).
+//   ticket: FIFO ticket lock; waiters are served in arrival order.
+//   mcs:    MCS queue lock; each waiter spins on its own node,
+//           so a release only touches the next waiter's cache line.
+
+// A waiter's place in an MCS lock's queue. Each CPU has a few
+// of these in struct cpu, since interrupts are off while it
+// holds or waits for a spinlock.
+struct mcsnode {
+  struct mcsnode *next; // Next waiter in the queue.
+  uint wait;            // Nonzero until our predecessor hands over.
+  uint inuse;           // Is this CPU using the node?
+};
+
 struct spinlock {
+#if defined(LOCK_TICKET)
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket of the current holder.
+#elif defined(LOCK_MCS)
+  struct mcsnode *tail;  // Last node in the queue, or 0 if free.
+  struct mcsnode *node;  // The holder's node.
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // Contention statistics, only updated by the holder:
+  uint64 nacquire;   // Number of acquisitions.
+  uint64 ncontended; // Acquisitions that had to spin.
+  uint64 nspin;      // Total spin iterations.
+  uint64 maxhold;    // Longest hold, in time-CSR cycles.
+  uint64 holdstart;  // When the current holder got the lock.
+
+  struct spinlock *regnext; // Registry list, see lockstat().
+  struct spinlock *regprev;
 };
 
@@ -104,6 +104,12 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_settickets(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_lockreset(void);
+extern uint64 sys_fsstat(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,6 +133,12 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_settickets] sys_settickets,
+[SYS_lockstat] sys_lockstat,
+[SYS_lockreset] sys_lockreset,
+[SYS_fsstat]  sys_fsstat,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
 };
 
 void
@@ -20,3 +20,9 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_settickets 22
+#define SYS_lockstat 23
+#define SYS_lockreset 24
+#define SYS_fsstat 25
+#define SYS_sync   26
+#define SYS_fsync  27
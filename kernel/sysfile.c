@@ -15,6 +15,26 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "fsstat.h"
+
+// Log blocks that FS system calls may write, for begin_op().
+// dirlink() may write a directory block, and if it grows the
+// directory, a bitmap block, its inode, and the indirect or
+// extent blocks on the paths to the new block (see filewrite()).
+// In a hashed directory it may split a leaf and DXDEPTH index
+// nodes, and write the root: 8 more blocks, with the new
+// blocks' bitmap blocks.
+#define DIRLINKBLOCKS (3 + 2*NLEVEL + 1 + 8)
+// and the linked inode, which iput() may give its delayed
+// blocks disk blocks, or if link fails and another name went
+// meanwhile, free
+#define LINKBLOCKS    (DIRLINKBLOCKS + 1 + IPUTBLOCKS)
+// a directory block, its inode, the inode, and freeing the inode
+#define UNLINKBLOCKS  (3 + IPUTBLOCKS)
+// the new inode and its inode bitmap block, the new
+// directory's block and its bitmap block, or putting an
+// existing inode, which may flush its delayed blocks
+#define CREATEBLOCKS  (DIRLINKBLOCKS + 4 + IPUTBLOCKS)
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -115,6 +135,36 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Commit everything written so far to disk.
+uint64
+sys_sync(void)
+{
+  iflushall();
+  log_force();
+  return 0;
+}
+
+// Make fd's file durable: give its delayed blocks disk
+// blocks, and commit. There's only the one log, so that
+// commits everything else written so far too.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE){
+    begin_op(IPUTBLOCKS);
+    ilock(f->ip);
+    iflush(f->ip);
+    iunlock(f->ip);
+    end_op();
+  }
+  log_force();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -125,7 +175,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(LINKBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +242,7 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(UNLINKBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -218,6 +268,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dinsert(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -258,7 +309,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -275,8 +326,18 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
-  if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+  // a hashed directory may have no room for the name.
+  if(dirlink(dp, name, ip->inum) < 0){
+    if(type == T_DIR){
+      dp->nlink--;
+      iupdate(dp);
+    }
+    ip->nlink = 0;
+    iupdate(ip);
+    iunlockput(ip);
+    iunlockput(dp);
+    return 0;
+  }
 
   iunlockput(dp);
 
@@ -295,7 +356,7 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op(omode & O_CREATE ? CREATEBLOCKS : IPUTBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -342,7 +403,7 @@ sys_open(void)
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
+    itrunclater(ip);
   }
 
   iunlock(ip);
@@ -357,7 +418,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -374,7 +435,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_op(CREATEBLOCKS);
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -394,7 +455,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_op(IPUTBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -484,3 +545,24 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// copy the file system statistics to a user struct fsstat.
+uint64
+sys_fsstat(void)
+{
+  uint64 addr;
+  struct fsstat st;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  memset(&st, 0, sizeof(st));
+  bstat(&st);
+  logstat(&st);
+  allocstat(&st);
+  icachestat(&st);
+  dcachestat(&st);
+  virtio_disk_stat(&st);
+  if(copyout(myproc()->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
@@ -95,3 +95,35 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// join the stride scheduling class with the given
+// number of tickets, or leave it if tickets is 0.
+uint64
+sys_settickets(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return settickets(n);
+}
+
+// copy statistics for the n most contended spinlocks
+// to a user array of struct lockstat.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return lockstat(addr, n);
+}
+
+uint64
+sys_lockreset(void)
+{
+  lockreset();
+  return 0;
+}
@@ -16,10 +16,18 @@
 #include "fs.h"
 #include "buf.h"
 #include "virtio.h"
+#include "fsstat.h"
 
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// the first descriptor of each request points to one of these.
+struct virtio_blk_outhdr {
+  uint32 type;
+  uint32 reserved;
+  uint64 sector;
+};
+
 static struct disk {
  // memory for virtio descriptors &c for queue 0.
  // this is a global instead of allocated because it must
@@ -40,7 +48,20 @@ static struct disk {
   struct {
     struct buf *b;
     char status;
+    char async;    // nobody waits; virtio_disk_intr() cleans up.
   } info[NUM];
+
+  // request headers, indexed like info[]. they can't be on
+  // the kernel stack, since async requests outlive the call.
+  struct virtio_blk_outhdr ops[NUM];
+
+  // requests, and how often and how far each one moved away
+  // from the block after the previous one: what a real
+  // disk's head would have had to seek.
+  uint lastblock;
+  uint64 nreq;
+  uint64 nseek;
+  uint64 seekdist;
   
   struct spinlock vdisk_lock;
   
@@ -165,13 +186,14 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// start a request to read or write b, and return the index
+// of its first descriptor. if nowait is set, return -1 rather
+// than wait for free descriptors. caller holds vdisk_lock.
+static int
+submit(struct buf *b, int write, int nowait)
 {
   uint64 sector = b->blockno * (BSIZE / 512);
 
-  acquire(&disk.vdisk_lock);
-
   // the spec says that legacy block operations use three
   // descriptors: one for type/reserved/sector, one for
   // the data, one for a 1-byte status result.
@@ -182,29 +204,25 @@ virtio_disk_rw(struct buf *b, int write)
     if(alloc3_desc(idx) == 0) {
       break;
     }
+    if(nowait)
+      return -1;
     sleep(&disk.free[0], &disk.vdisk_lock);
   }
   
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_outhdr {
-    uint32 type;
-    uint32 reserved;
-    uint64 sector;
-  } buf0;
+  struct virtio_blk_outhdr *buf0 = &disk.ops[idx[0]];
 
   if(write)
-    buf0.type = VIRTIO_BLK_T_OUT; // write the disk
+    buf0->type = VIRTIO_BLK_T_OUT; // write the disk
   else
-    buf0.type = VIRTIO_BLK_T_IN; // read the disk
-  buf0.reserved = 0;
-  buf0.sector = sector;
-
-  // buf0 is on a kernel stack, which is not direct mapped,
-  // thus the call to kvmpa().
-  disk.desc[idx[0]].addr = (uint64) kvmpa((uint64) &buf0);
-  disk.desc[idx[0]].len = sizeof(buf0);
+    buf0->type = VIRTIO_BLK_T_IN; // read the disk
+  buf0->reserved = 0;
+  buf0->sector = sector;
+
+  disk.desc[idx[0]].addr = (uint64) buf0;
+  disk.desc[idx[0]].len = sizeof(*buf0);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
@@ -223,9 +241,20 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
   disk.desc[idx[2]].next = 0;
 
+  disk.nreq++;
+  if(b->blockno != disk.lastblock + 1){
+    disk.nseek++;
+    if(b->blockno > disk.lastblock)
+      disk.seekdist += b->blockno - disk.lastblock;
+    else
+      disk.seekdist += disk.lastblock - b->blockno;
+  }
+  disk.lastblock = b->blockno;
+
   // record struct buf for virtio_disk_intr().
   b->disk = 1;
   disk.info[idx[0]].b = b;
+  disk.info[idx[0]].async = nowait;
 
   // avail[0] is flags
   // avail[1] tells the device how far to look in avail[2...].
@@ -237,17 +266,66 @@ virtio_disk_rw(struct buf *b, int write)
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
 
+  return idx[0];
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  int id;
+
+  acquire(&disk.vdisk_lock);
+
+  id = submit(b, write, 0);
+
   // Wait for virtio_disk_intr() to say request has finished.
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  disk.info[id].b = 0;
+  free_chain(id);
 
   release(&disk.vdisk_lock);
 }
 
+// start reading b from disk without waiting for it.
+// virtio_disk_intr() marks it valid when the read completes.
+// returns -1, doing nothing, if b is valid or already being
+// read, or if the queue is full.
+int
+virtio_disk_read_async(struct buf *b)
+{
+  int r = -1;
+
+  acquire(&disk.vdisk_lock);
+  if(!b->valid && !b->disk && submit(b, 0, 1) >= 0)
+    r = 0;
+  release(&disk.vdisk_lock);
+  return r;
+}
+
+// wait for an async read of b to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1)
+    sleep(b, &disk.vdisk_lock);
+  release(&disk.vdisk_lock);
+}
+
+// fill in the disk's part of st.
+void
+virtio_disk_stat(struct fsstat *st)
+{
+  acquire(&disk.vdisk_lock);
+  st->ndiskreq = disk.nreq;
+  st->nseek = disk.nseek;
+  st->seekdist = disk.seekdist;
+  release(&disk.vdisk_lock);
+}
+
 void
 virtio_disk_intr()
 {
@@ -259,8 +337,14 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
     
-    disk.info[id].b->disk = 0;   // disk is done with buf
-    wakeup(disk.info[id].b);
+    struct buf *b = disk.info[id].b;
+    if(disk.info[id].async){
+      b->valid = 1;
+      disk.info[id].b = 0;
+      free_chain(id);
+    }
+    b->disk = 0;   // disk is done with buf
+    wakeup(b);
 
     disk.used_idx = (disk.used_idx + 1) % NUM;
   }
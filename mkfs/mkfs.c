@@ -15,16 +15,20 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 4096
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+// [ boot block | sb block | log | block group 0 | block group 1 | ... ]
+// and each group:
+// [ inode bit map | free bit map | inode blocks | data blocks ]
+
+int nlog = 2*(LOGSIZE+1);  // two log regions, each a header and LOGSIZE blocks
+int ngroups;  // Number of block groups
+int ipg;      // Inodes per group
+int ngmeta;   // Number of meta blocks in each group (bitmaps, inode)
+int nmeta;    // Number of meta blocks (boot, sb, nlog, and the groups')
 int nblocks;  // Number of data blocks
+int fssize;   // Size of the file system, if less than FSSIZE
 
 int fsfd;
 struct superblock sb;
@@ -34,12 +38,14 @@ uint freeblock;
 
 
 void balloc(int);
+void imapwrite(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint bmap(struct dinode *din, uint fbn);
 
 // convert to intel byte order
 ushort
@@ -91,24 +97,37 @@ main(int argc, char *argv[])
   }
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  // divide the disk after the log into groups, sharing the
+  // inodes out between them; leave off a last group too small
+  // to hold more than its own metadata.
+  ngroups = (FSSIZE - (2 + nlog) + BPG - 1) / BPG;
+  ipg = (NINODES / ngroups + IPB - 1) / IPB * IPB;
+  ngmeta = 2 + ipg / IPB;
+  fssize = FSSIZE;
+  if((FSSIZE - (2 + nlog)) % BPG != 0 && (FSSIZE - (2 + nlog)) % BPG <= ngmeta){
+    fssize -= (FSSIZE - (2 + nlog)) % BPG;
+    ngroups--;
+  }
+  assert(ipg <= BPB);
+  nmeta = 2 + nlog + ngroups * ngmeta;
+  nblocks = fssize - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ngroups * ipg);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
-  sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.gstart = xint(2+nlog);
+  sb.ngroups = xint(ngroups);
+  sb.ipg = xint(ipg);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u, %d groups of inode bitmap, bitmap and %u inode blocks) blocks %d total %d\n",
+         nmeta, nlog, ngroups, (uint)(ipg / IPB), nblocks, fssize);
 
-  freeblock = nmeta;     // the first free block that we can allocate
+  freeblock = GDATA(0, sb);     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < fssize; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -163,14 +182,17 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // fix size of root inode dir, unless it still fits inline
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(!(xint(din.flags) & I_INLINE)){
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
+  imapwrite(freeinode);
 
   exit(0);
 }
@@ -238,28 +260,89 @@ ialloc(ushort type)
   din.type = xshort(type);
   din.nlink = xshort(1);
   din.size = xint(0);
+  din.flags = xint(I_INLINE);
   winode(inum, &din);
   return inum;
 }
 
+// Write the groups' bitmaps, marking their metadata blocks
+// allocated, and the blocks of group 0 up to used.
 void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int g, i, n;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
+  assert(ngroups == 1 || used <= GSTART(1, sb));
+  for(g = 0; g < ngroups; g++){
+    bzero(buf, BSIZE);
+    n = g == 0 ? used - GSTART(0, sb) : ngmeta;
+    for(i = 0; i < n; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    wsect(BBLOCK(GSTART(g, sb), sb), buf);
+  }
+}
+
+// Mark inodes 0 (which is never used) up to used
+// allocated in group 0's inode bitmap.
+void
+imapwrite(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  printf("imapwrite: first %d inodes have been allocated\n", used);
+  assert(used <= ipg);
   bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  wsect(IMBLOCK(0, sb), buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block number of block fbn of the file with
+// inode din, allocating it and any indirect blocks needed.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint n, x;
+  int level;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+  n = NINDIRECT;
+  for(level = 1; fbn >= n; level++){
+    assert(level < NLEVEL);
+    fbn -= n;
+    n *= NINDIRECT;
+  }
+  if(xint(din->addrs[NDIRECT+level-1]) == 0){
+    din->addrs[NDIRECT+level-1] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT+level-1]);
+  for(; level > 0; level--){
+    n /= NINDIRECT;
+    rsect(x, (char*)indirect);
+    if(indirect[fbn / n] == 0){
+      indirect[fbn / n] = xint(freeblock++);
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[fbn / n]);
+    fbn %= n;
+  }
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,31 +350,32 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
   off = xint(din.size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  if(xint(din.flags) & I_INLINE){
+    if(off + n <= NINLINE){
+      bcopy(p, din.data + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // too big to keep in the inode: move what's there to blocks.
+    bcopy(din.data, buf, off);
+    bzero(din.data, sizeof(din.data));
+    din.flags = xint(0);
+    din.size = xint(0);
+    winode(inum, &din);
+    if(off > 0)
+      iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
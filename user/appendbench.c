@@ -0,0 +1,150 @@
+//
+// appendbench [nblocks]
+//
+// Interleaved append benchmark. NCHILD processes each append to a
+// file of their own, a piece at a time, so that an allocator that
+// gives blocks out in write order interleaves the files' blocks.
+// Prints the time taken and the disk requests and seeks from
+// fsstat(), then reads each file back, checking it, the same way.
+// With delayed allocation each file's blocks should be contiguous.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NCHILD 4
+#define PIECE  512
+
+char buf[PIECE];
+struct fsstat before, after;
+int t0;
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "appendX");
+  s[6] = 'a' + i;
+}
+
+void
+start(void)
+{
+  sync();
+  fsstat(&before);
+  t0 = uptime();
+}
+
+void
+report(char *phase)
+{
+  uint64 nseek;
+
+  sync();
+  fsstat(&after);
+  nseek = after.nseek - before.nseek;
+  printf("appendbench: %s %d ticks, %l requests, %l seeks, %l blocks average seek\n",
+         phase, uptime() - t0, after.ndiskreq - before.ndiskreq, nseek,
+         nseek ? (after.seekdist - before.seekdist) / nseek : 0);
+}
+
+void
+appender(int i, int nblocks)
+{
+  char fname[8];
+  int fd, p;
+
+  name(fname, i);
+  fd = open(fname, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("appendbench: create %s failed\n", fname);
+    exit(1);
+  }
+  for(p = 0; p < nblocks * (BSIZE / PIECE); p++){
+    memset(buf, i + p, PIECE);
+    if(write(fd, buf, PIECE) != PIECE){
+      printf("appendbench: write %s failed\n", fname);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+reader(int i, int nblocks)
+{
+  char fname[8];
+  int fd, p;
+
+  name(fname, i);
+  fd = open(fname, O_RDONLY);
+  if(fd < 0){
+    printf("appendbench: open %s failed\n", fname);
+    exit(1);
+  }
+  for(p = 0; p < nblocks * (BSIZE / PIECE); p++){
+    if(read(fd, buf, PIECE) != PIECE || buf[0] != (char)(i + p) ||
+       buf[PIECE-1] != (char)(i + p)){
+      printf("appendbench: read %s failed\n", fname);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// run f in NCHILD processes at once.
+void
+run(void (*f)(int, int), int nblocks)
+{
+  int i, xstatus;
+
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("appendbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      f(i, nblocks);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char fname[8];
+  int nblocks, i;
+
+  nblocks = 200;
+  if(argc > 1)
+    nblocks = atoi(argv[1]);
+  if(nblocks < 1){
+    fprintf(2, "usage: appendbench [nblocks]\n");
+    exit(1);
+  }
+
+  printf("appendbench: %d processes appending %d blocks each\n", NCHILD, nblocks);
+  start();
+  run(appender, nblocks);
+  report("append");
+  start();
+  run(reader, nblocks);
+  report("read");
+
+  for(i = 0; i < NCHILD; i++){
+    name(fname, i);
+    unlink(fname);
+  }
+  printf("appendbench: OK\n");
+  exit(0);
+}
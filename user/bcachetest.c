@@ -0,0 +1,125 @@
+//
+// Buffer cache contention benchmark.
+//
+// Each of NCHILD processes repeatedly reads its own small file,
+// so they all hit in the buffer cache but on different blocks.
+// With a per-bucket locked buffer cache they should rarely
+// contend; reports the contention on the bcache locks.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define NCHILD  4
+#define NBLOCK  4     // blocks per file, so all files fit in the cache
+#define ROUNDS  500
+#define NSTATS  64
+
+char buf[BSIZE];
+struct lockstat stats[NSTATS];
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "bcachetest.X");
+  s[11] = 'a' + i;
+}
+
+void
+createfile(int i)
+{
+  char fname[16];
+  int fd, b;
+
+  name(fname, i);
+  fd = open(fname, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("bcachetest: create %s failed\n", fname);
+    exit(1);
+  }
+  for(b = 0; b < NBLOCK; b++){
+    memset(buf, 'a' + i + b, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("bcachetest: write %s failed\n", fname);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(int i)
+{
+  char fname[16];
+  int fd, b, r;
+
+  name(fname, i);
+  for(r = 0; r < ROUNDS; r++){
+    if((fd = open(fname, O_RDONLY)) < 0){
+      printf("bcachetest: open %s failed\n", fname);
+      exit(1);
+    }
+    for(b = 0; b < NBLOCK; b++){
+      if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a' + i + b){
+        printf("bcachetest: read %s failed\n", fname);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, t0, xstatus;
+  uint64 acq, cont, spins;
+  char fname[16];
+
+  printf("bcachetest: start\n");
+  for(i = 0; i < NCHILD; i++)
+    createfile(i);
+
+  lockreset();
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bcachetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      readfile(i);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  printf("bcachetest: %d readers took %d ticks\n", NCHILD, uptime() - t0);
+
+  acq = cont = spins = 0;
+  n = lockstat(stats, NSTATS);
+  for(i = 0; i < n; i++){
+    if(strcmp(stats[i].name, "bcache") == 0 || strcmp(stats[i].name, "bcache.bucket") == 0){
+      acq += stats[i].nacquire;
+      cont += stats[i].ncontended;
+      spins += stats[i].nspin;
+    }
+  }
+  printf("bcachetest: bcache locks: %l acquires, %l contended, %l spins\n",
+         acq, cont, spins);
+
+  for(i = 0; i < NCHILD; i++){
+    name(fname, i);
+    unlink(fname);
+  }
+  printf("bcachetest: OK\n");
+  exit(0);
+}
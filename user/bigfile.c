@@ -0,0 +1,103 @@
+//
+// bigfile [kbytes]
+//
+// Large file throughput test. Writes a file big enough to need
+// double-indirect blocks (by default), reads it back checking
+// every block, and reports write and read throughput. Each
+// block starts with its block number, so misplaced blocks show.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define NBLOCK (NDIRECT + NINDIRECT + 4*NINDIRECT)
+
+char buf[BSIZE];
+
+void
+fill(int b)
+{
+  int j;
+
+  for(j = 0; j < BSIZE; j++)
+    buf[j] = b + j;
+  ((int*)buf)[0] = b;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "bigfile.tmp";
+  int fd, b, j, n, t;
+
+  n = NBLOCK;
+  if(argc > 1)
+    n = atoi(argv[1]) * 1024 / BSIZE;
+  if(n < 1){
+    fprintf(2, "usage: bigfile [kbytes]\n");
+    exit(1);
+  }
+  printf("bigfile: %d blocks\n", n);
+
+  t = uptime();
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("bigfile: create failed\n");
+    exit(1);
+  }
+  for(b = 0; b < n; b++){
+    fill(b);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("bigfile: write of block %d failed\n", b);
+      exit(1);
+    }
+  }
+  if(fsync(fd) < 0){
+    printf("bigfile: fsync failed\n");
+    exit(1);
+  }
+  close(fd);
+  t = uptime() - t;
+  if(t < 1)
+    t = 1;
+  printf("bigfile: wrote %d KB in %d ticks, %d KB/tick\n", n * BSIZE / 1024, t, n * BSIZE / 1024 / t);
+
+  t = uptime();
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("bigfile: open failed\n");
+    exit(1);
+  }
+  for(b = 0; b < n; b++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("bigfile: short read at block %d\n", b);
+      exit(1);
+    }
+    if(((int*)buf)[0] != b){
+      printf("bigfile: block %d holds block %d\n", b, ((int*)buf)[0]);
+      exit(1);
+    }
+    for(j = sizeof(int); j < BSIZE; j++){
+      if(buf[j] != (char)(b + j)){
+        printf("bigfile: wrong data in block %d\n", b);
+        exit(1);
+      }
+    }
+  }
+  if(read(fd, buf, BSIZE) != 0){
+    printf("bigfile: file too long\n");
+    exit(1);
+  }
+  close(fd);
+  t = uptime() - t;
+  if(t < 1)
+    t = 1;
+  printf("bigfile: read %d KB in %d ticks, %d KB/tick\n", n * BSIZE / 1024, t, n * BSIZE / 1024 / t);
+
+  unlink(name);
+  printf("bigfile: OK\n");
+  exit(0);
+}
@@ -0,0 +1,84 @@
+//
+// createbench [nbatch]
+//
+// File creation benchmark. Creates nbatch batches of NFILE empty
+// files, each batch in its own directory so that directory
+// lookups cost the same for every batch, and prints the time each
+// batch took. With the inode bitmap, the cost of allocating an
+// inode shouldn't grow as the inode table fills up.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NFILE 100
+
+struct fsstat st;
+
+void
+name(char *s, int d, int f)
+{
+  strcpy(s, "cbXX/fXX");
+  s[2] = 'a' + d / 26;
+  s[3] = 'a' + d % 26;
+  s[6] = 'a' + f / 26;
+  s[7] = 'a' + f % 26;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int nbatch, d, f, fd, t;
+
+  nbatch = 20;
+  if(argc > 1)
+    nbatch = atoi(argv[1]);
+  if(nbatch < 1 || nbatch > 26*26){
+    fprintf(2, "usage: createbench [nbatch]\n");
+    exit(1);
+  }
+
+  fsstat(&st);
+  printf("createbench: %d batches of %d files, %l inodes free\n", nbatch, NFILE, st.nifree);
+  for(d = 0; d < nbatch; d++){
+    name(path, d, 0);
+    path[4] = 0;
+    t = uptime();
+    if(mkdir(path) < 0){
+      printf("createbench: mkdir %s failed\n", path);
+      exit(1);
+    }
+    for(f = 0; f < NFILE; f++){
+      name(path, d, f);
+      fd = open(path, O_CREATE|O_RDWR);
+      if(fd < 0){
+        printf("createbench: create %s failed\n", path);
+        exit(1);
+      }
+      close(fd);
+    }
+    printf("createbench: batch %d took %d ticks\n", d, uptime() - t);
+  }
+
+  for(d = 0; d < nbatch; d++){
+    for(f = 0; f < NFILE; f++){
+      name(path, d, f);
+      if(unlink(path) < 0){
+        printf("createbench: unlink %s failed\n", path);
+        exit(1);
+      }
+    }
+    name(path, d, 0);
+    path[4] = 0;
+    if(unlink(path) < 0){
+      printf("createbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("createbench: OK\n");
+  exit(0);
+}
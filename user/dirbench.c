@@ -0,0 +1,109 @@
+//
+// dirbench [nentries]
+//
+// Large directory benchmark. Creates nentries links to one file
+// in a new directory, then opens each name, then unlinks each,
+// and prints the time each phase took. In a hashed directory
+// every lookup reads the same few blocks however many entries
+// there are, so the phases should take time linear in nentries,
+// not quadratic.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+void
+name(char *s, int i)
+{
+  int j;
+
+  strcpy(s, "dirbench.d/nXXXXX");
+  for(j = 16; j >= 12; j--){
+    s[j] = '0' + i % 10;
+    i /= 10;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[32];
+  int n, i, fd, t;
+
+  n = 10000;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n < 1 || n > 99999){
+    fprintf(2, "usage: dirbench [nentries]\n");
+    exit(1);
+  }
+
+  if(mkdir("dirbench.d") < 0){
+    printf("dirbench: mkdir failed\n");
+    exit(1);
+  }
+  fd = open("dirbench.d/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("dirbench: create failed\n");
+    exit(1);
+  }
+  close(fd);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if(link("dirbench.d/f", path) < 0){
+      printf("dirbench: link %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("dirbench: create %d entries: %d ticks\n", n, uptime() - t);
+
+  // "." and ".." of a hashed directory aren't in its leaves;
+  // check they are still found, and can't be created again.
+  if(chdir("dirbench.d/../dirbench.d/.") < 0){
+    printf("dirbench: chdir through .. failed\n");
+    exit(1);
+  }
+  if((fd = open("../dirbench.d/./f", O_RDONLY)) < 0){
+    printf("dirbench: open through .. failed\n");
+    exit(1);
+  }
+  close(fd);
+  if(mkdir(".") == 0 || mkdir("..") == 0){
+    printf("dirbench: mkdir . or .. succeeded\n");
+    exit(1);
+  }
+  if(chdir("..") < 0){
+    printf("dirbench: chdir .. failed\n");
+    exit(1);
+  }
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf("dirbench: open %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  printf("dirbench: look up %d entries: %d ticks\n", n, uptime() - t);
+
+  t = uptime();
+  for(i = 0; i < n; i++){
+    name(path, i);
+    if(unlink(path) < 0){
+      printf("dirbench: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  printf("dirbench: unlink %d entries: %d ticks\n", n, uptime() - t);
+
+  unlink("dirbench.d/f");
+  unlink("dirbench.d");
+  printf("dirbench: OK\n");
+  exit(0);
+}
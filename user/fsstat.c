@@ -0,0 +1,77 @@
+//
+// fsstat [command args...]
+//
+// Print the file system statistics. With a command, run it
+// and print how much the counters changed while it ran.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+struct fsstat before, after;
+
+int
+main(int argc, char *argv[])
+{
+  int pid;
+  uint64 total;
+
+  if(fsstat(&before) < 0){
+    fprintf(2, "fsstat: fsstat failed\n");
+    exit(1);
+  }
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "fsstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "fsstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+  }
+  fsstat(&after);
+  if(argc > 1){
+    after.bhit -= before.bhit;
+    after.bmiss -= before.bmiss;
+    after.rahead -= before.rahead;
+    after.ncommit -= before.ncommit;
+    after.nbatched -= before.nbatched;
+    after.nordered -= before.nordered;
+    after.dhit -= before.dhit;
+    after.dmiss -= before.dmiss;
+    after.ihit -= before.ihit;
+    after.imiss -= before.imiss;
+    after.niupdate -= before.niupdate;
+    after.niwrite -= before.niwrite;
+    after.ndiskreq -= before.ndiskreq;
+    after.nseek -= before.nseek;
+    after.seekdist -= before.seekdist;
+  }
+
+  total = after.bhit + after.bmiss;
+  printf("bcache: %l hits %l misses (%d%% hits), %l of max %l buffers\n",
+         after.bhit, after.bmiss, total ? (int)(after.bhit * 100 / total) : 0,
+         after.nbuf, after.maxbuf);
+  printf("bcache: %l blocks read ahead\n", after.rahead);
+  total = after.ihit + after.imiss;
+  printf("icache: %l hits %l misses (%d%% hits), %l inodes\n", after.ihit,
+         after.imiss, total ? (int)(after.ihit * 100 / total) : 0, after.ninode);
+  printf("icache: %l inode updates, %l inodes written\n", after.niupdate,
+         after.niwrite);
+  total = after.dhit + after.dmiss;
+  printf("dcache: %l hits %l misses (%d%% hits)\n", after.dhit, after.dmiss,
+         total ? (int)(after.dhit * 100 / total) : 0);
+  printf("log: %l commits, %l commits avoided\n", after.ncommit, after.nbatched);
+  printf("log: %l data blocks written in place\n", after.nordered);
+  printf("disk: %l free blocks (%l reserved), %l free inodes, %l orphans\n",
+         after.nfree, after.nreserved, after.nifree, after.norphan);
+  printf("disk: %l requests, %l seeks, %l blocks average seek\n", after.ndiskreq,
+         after.nseek, after.nseek ? after.seekdist / after.nseek : 0);
+  exit(0);
+}
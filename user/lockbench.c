@@ -0,0 +1,92 @@
+//
+// lockbench [nproc]
+//
+// Spinlock contention benchmark. nproc processes (default 3,
+// one per hart with the default CPUS) call uptime() in a tight
+// loop for a fixed number of ticks. Each call takes tickslock,
+// so the harts fight over one lock with a tiny critical section.
+//
+// Reports total throughput, how evenly it was shared among the
+// processes, and the contention statistics of tickslock ("time").
+// Build the kernel with make LOCK=tas, LOCK=ticket or LOCK=mcs
+// (after make clean) to compare the spinlock implementations.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define TICKS  20
+#define NSTATS 8
+
+struct lockstat stats[NSTATS];
+
+int
+main(int argc, char *argv[])
+{
+  int nproc, fds[2], start, deadline;
+  uint64 calls, total, min, max;
+
+  nproc = 3;
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(nproc < 1 || nproc > NPROC/2){
+    fprintf(2, "usage: lockbench [nproc]\n");
+    exit(1);
+  }
+
+  if(pipe(fds) < 0){
+    fprintf(2, "lockbench: pipe failed\n");
+    exit(1);
+  }
+
+  lockreset();
+  start = uptime() + 2;
+  deadline = start + TICKS;
+  for(int i = 0; i < nproc; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      // start together, once everyone has been forked.
+      while(uptime() < start)
+        ;
+      calls = 0;
+      while(uptime() < deadline)
+        calls++;
+      write(fds[1], &calls, sizeof(calls));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  total = 0;
+  min = ~0ULL;
+  max = 0;
+  while(read(fds[0], &calls, sizeof(calls)) == sizeof(calls)){
+    total += calls;
+    if(calls < min)
+      min = calls;
+    if(calls > max)
+      max = calls;
+  }
+  for(int i = 0; i < nproc; i++)
+    wait(0);
+
+  printf("lockbench: %d procs, %l acquires in %d ticks\n", nproc, total, TICKS);
+  printf("lockbench: per proc min %l max %l, fairness %d%%\n",
+         min, max, max ? (int)(min * 100 / max) : 0);
+
+  int n = lockstat(stats, NSTATS);
+  for(int i = 0; i < n; i++){
+    if(strcmp(stats[i].name, "time") == 0)
+      printf("lockbench: tickslock contended %l of %l, spins %l\n",
+             stats[i].ncontended, stats[i].nacquire, stats[i].nspin);
+  }
+  exit(0);
+}
@@ -0,0 +1,61 @@
+//
+// lockstat [-n N] [command args...]
+//
+// Reset the kernel's spinlock statistics, run command, and
+// report the N most contended kinds of lock (locks with the
+// same name are added up). With no command, report the
+// statistics accumulated since boot (or the last reset).
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+#define MAXN 32
+
+struct lockstat stats[MAXN];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, cnt, pid;
+
+  n = 10;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    n = atoi(argv[2]);
+    i = 3;
+  }
+  if(n < 1 || n > MAXN){
+    fprintf(2, "lockstat: -n must be between 1 and %d\n", MAXN);
+    exit(1);
+  }
+
+  if(i < argc){
+    lockreset();
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[i], argv + i);
+      fprintf(2, "lockstat: exec %s failed\n", argv[i]);
+      exit(1);
+    }
+    wait(0);
+  }
+
+  if((cnt = lockstat(stats, n)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+
+  printf("name acquires contended spins maxhold\n");
+  for(i = 0; i < cnt; i++){
+    printf("%s %l %l %l %l\n", stats[i].name, stats[i].nacquire,
+           stats[i].ncontended, stats[i].nspin, stats[i].maxhold);
+  }
+  exit(0);
+}
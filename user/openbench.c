@@ -0,0 +1,152 @@
+//
+// openbench [nfiles]
+//
+// Inode cache benchmark. Creates nfiles files and has child
+// processes hold all of them open at once, PERCHILD each, so that
+// many more inodes are in use than the cache starts with. Then
+// each child repeatedly reopens its files, and stats them through
+// the open descriptors, and the parent prints the time taken and
+// the inode cache's hits and misses and size from fsstat().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define PERCHILD 10  // leaves room in NOFILE for stdio, pipes and a reopen
+#define ROUNDS   20
+
+struct fsstat before, after;
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "ob.d/fXXX");
+  s[6] = 'a' + i / 676;
+  s[7] = 'a' + i / 26 % 26;
+  s[8] = 'a' + i % 26;
+}
+
+// Open files first..first+n-1 and keep them open; tell the parent
+// on ready, wait for go to be closed, then reopen and stat them.
+void
+child(int first, int n, int ready, int go)
+{
+  char path[16], c;
+  int fd[PERCHILD], i, r, f;
+  struct stat st;
+
+  for(i = 0; i < n; i++){
+    name(path, first + i);
+    if((fd[i] = open(path, O_RDONLY)) < 0){
+      printf("openbench: open %s failed\n", path);
+      exit(1);
+    }
+  }
+  write(ready, "x", 1);
+  read(go, &c, 1);
+
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < n; i++){
+      name(path, first + i);
+      if((f = open(path, O_RDONLY)) < 0){
+        printf("openbench: reopen %s failed\n", path);
+        exit(1);
+      }
+      close(f);
+      if(fstat(fd[i], &st) < 0){
+        printf("openbench: fstat %s failed\n", path);
+        exit(1);
+      }
+    }
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16], c;
+  int nfiles, nchild, i, fd, t, xstatus, failed;
+  int ready[2], go[2];
+  uint64 nget;
+
+  nfiles = 300;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1 || nfiles > 26*26*26){
+    fprintf(2, "usage: openbench [nfiles]\n");
+    exit(1);
+  }
+
+  if(mkdir("ob.d") < 0){
+    printf("openbench: mkdir failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("openbench: create %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("openbench: pipe failed\n");
+    exit(1);
+  }
+  nchild = 0;
+  for(i = 0; i < nfiles; i += PERCHILD){
+    int pid = fork();
+    if(pid < 0){
+      printf("openbench: fork failed\n");
+      break;
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(go[1]);
+      child(i, nfiles - i < PERCHILD ? nfiles - i : PERCHILD, ready[1], go[0]);
+    }
+    nchild++;
+  }
+  close(ready[1]);
+  close(go[0]);
+  for(i = 0; i < nchild; i++)
+    read(ready[0], &c, 1);
+
+  fsstat(&before);
+  printf("openbench: %d processes holding %d files open, %l inodes cached\n",
+         nchild, nfiles, before.ninode);
+  t = uptime();
+  close(go[1]);
+  failed = 0;
+  for(i = 0; i < nchild; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  t = uptime() - t;
+  fsstat(&after);
+  close(ready[0]);
+
+  nget = (after.ihit - before.ihit) + (after.imiss - before.imiss);
+  printf("openbench: %d reopens: %d ticks\n", ROUNDS * nfiles, t);
+  printf("openbench: icache %l hits %l misses (%d%% hits), %l inodes cached\n",
+         after.ihit - before.ihit, after.imiss - before.imiss,
+         nget ? (int)((after.ihit - before.ihit) * 100 / nget) : 0, after.ninode);
+
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    unlink(path);
+  }
+  unlink("ob.d");
+  if(failed){
+    printf("openbench: FAILED\n");
+    exit(1);
+  }
+  printf("openbench: OK\n");
+  exit(0);
+}
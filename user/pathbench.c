@@ -0,0 +1,99 @@
+//
+// pathbench [rounds]
+//
+// Path lookup benchmark. Makes a few levels of directories with
+// files at the bottom, then repeatedly opens each file by its full
+// path and tries to open names that don't exist, as find, sh's
+// PATH search and make do. Prints the time taken and how often
+// the dentry cache answered a lookup.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NFILE 20
+
+char *dirs[] = { "pb", "pb/usr", "pb/usr/local", "pb/usr/local/share" };
+#define NDIR (sizeof(dirs)/sizeof(dirs[0]))
+struct fsstat before, after;
+
+void
+name(char *s, char *prefix, int i)
+{
+  strcpy(s, "pb/usr/local/share/");
+  s += strlen(s);
+  strcpy(s, prefix);
+  s += strlen(s);
+  s[0] = 'a' + i / 26;
+  s[1] = 'a' + i % 26;
+  s[2] = 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[64];
+  int rounds, r, i, fd, t;
+  uint64 nlookup;
+
+  rounds = 200;
+  if(argc > 1)
+    rounds = atoi(argv[1]);
+  if(rounds < 1){
+    fprintf(2, "usage: pathbench [rounds]\n");
+    exit(1);
+  }
+
+  for(i = 0; i < NDIR; i++){
+    if(mkdir(dirs[i]) < 0){
+      printf("pathbench: mkdir %s failed\n", dirs[i]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NFILE; i++){
+    name(path, "f", i);
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0){
+      printf("pathbench: create %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fsstat(&before);
+  t = uptime();
+  for(r = 0; r < rounds; r++){
+    for(i = 0; i < NFILE; i++){
+      name(path, "f", i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf("pathbench: open %s failed\n", path);
+        exit(1);
+      }
+      close(fd);
+      name(path, "missing", i);
+      if(open(path, O_RDONLY) >= 0){
+        printf("pathbench: open %s succeeded\n", path);
+        exit(1);
+      }
+    }
+  }
+  t = uptime() - t;
+  fsstat(&after);
+  nlookup = (after.dhit - before.dhit) + (after.dmiss - before.dmiss);
+  printf("pathbench: %d opens of %d-component paths: %d ticks\n",
+         2 * rounds * NFILE, (int)NDIR + 1, t);
+  printf("pathbench: dcache %l hits %l misses (%d%% hits)\n",
+         after.dhit - before.dhit, after.dmiss - before.dmiss,
+         nlookup ? (int)((after.dhit - before.dhit) * 100 / nlookup) : 0);
+
+  for(i = 0; i < NFILE; i++){
+    name(path, "f", i);
+    unlink(path);
+  }
+  for(i = (int)NDIR - 1; i >= 0; i--)
+    unlink(dirs[i]);
+  printf("pathbench: OK\n");
+  exit(0);
+}
@@ -0,0 +1,122 @@
+//
+// Parallel read throughput test.
+//
+// Several processes read the same file at once, each through its
+// own file descriptor. Since read() takes the inode lock shared,
+// they should get close to N times the throughput of one reader
+// (up to the number of harts). Also checks that every reader
+// sees the right data.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define FILESZ  (64*BSIZE)
+#define ROUNDS  20
+#define NREADER 3
+
+char buf[BSIZE];
+
+void
+makefile(char *name)
+{
+  int fd, i, j;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("preadtest: create %s failed\n", name);
+    exit(1);
+  }
+  for(i = 0; i < FILESZ/BSIZE; i++){
+    for(j = 0; j < BSIZE; j++)
+      buf[j] = i + j;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("preadtest: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// read the whole file ROUNDS times, checking its contents.
+void
+reader(char *name)
+{
+  int fd, i, j, r;
+
+  for(r = 0; r < ROUNDS; r++){
+    fd = open(name, O_RDONLY);
+    if(fd < 0){
+      printf("preadtest: open %s failed\n", name);
+      exit(1);
+    }
+    for(i = 0; i < FILESZ/BSIZE; i++){
+      if(read(fd, buf, BSIZE) != BSIZE){
+        printf("preadtest: short read\n");
+        exit(1);
+      }
+      for(j = 0; j < BSIZE; j++){
+        if(buf[j] != (char)(i + j)){
+          printf("preadtest: wrong data in block %d\n", i);
+          exit(1);
+        }
+      }
+    }
+    close(fd);
+  }
+}
+
+// run n readers in parallel; return elapsed ticks.
+int
+run(char *name, int n)
+{
+  int i, t0, xstatus;
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("preadtest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      reader(name);
+      exit(0);
+    }
+  }
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "preadfile";
+  int t1, tn;
+
+  printf("preadtest: start\n");
+  makefile(name);
+
+  // warm the cache, then time one reader and NREADER readers.
+  run(name, 1);
+  t1 = run(name, 1);
+  tn = run(name, NREADER);
+  if(t1 < 1)
+    t1 = 1;
+  if(tn < 1)
+    tn = 1;
+
+  printf("preadtest: 1 reader %d ticks, %d readers %d ticks\n", t1, NREADER, tn);
+  printf("preadtest: parallel speedup %d%%\n", NREADER * t1 * 100 / tn);
+
+  unlink(name);
+  printf("preadtest: OK\n");
+  exit(0);
+}
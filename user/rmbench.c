@@ -0,0 +1,94 @@
+//
+// rmbench [nblocks]
+//
+// Big file removal benchmark. Writes two files of nblocks blocks
+// each a piece at a time, in turn, so that their blocks are
+// interleaved and each has many extents. Then removes one and
+// truncates the other with open(O_TRUNC), printing how long each
+// call took and how long the orphan worker took to free the
+// blocks in the background, from fsstat().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define PIECE 64   // blocks written to one file before the other
+
+char buf[BSIZE];
+struct fsstat st;
+
+// wait for the orphan worker to finish, and report.
+void
+drained(char *what, int t0)
+{
+  for(;;){
+    fsstat(&st);
+    if(st.norphan == 0)
+      break;
+    sleep(1);
+  }
+  printf("rmbench: %s freed after %d ticks, %l blocks free\n",
+         what, uptime() - t0, st.nfree);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nblocks, fd[2], i, j, b, t;
+
+  nblocks = 4096;
+  if(argc > 1)
+    nblocks = atoi(argv[1]);
+  if(nblocks < 1){
+    fprintf(2, "usage: rmbench [nblocks]\n");
+    exit(1);
+  }
+
+  fd[0] = open("rm.a", O_CREATE|O_WRONLY|O_TRUNC);
+  fd[1] = open("rm.b", O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd[0] < 0 || fd[1] < 0){
+    printf("rmbench: create failed\n");
+    exit(1);
+  }
+  for(b = 0; b < nblocks; b += PIECE){
+    for(i = 0; i < 2; i++){
+      for(j = b; j < b + PIECE && j < nblocks; j++){
+        if(write(fd[i], buf, BSIZE) != BSIZE){
+          printf("rmbench: write failed\n");
+          exit(1);
+        }
+      }
+      // give the blocks disk blocks now, so the files interleave.
+      fsync(fd[i]);
+    }
+  }
+  close(fd[0]);
+  close(fd[1]);
+  fsstat(&st);
+  printf("rmbench: two files of %d blocks, %l blocks free\n", nblocks, st.nfree);
+
+  t = uptime();
+  if(unlink("rm.a") < 0){
+    printf("rmbench: unlink failed\n");
+    exit(1);
+  }
+  printf("rmbench: unlink took %d ticks\n", uptime() - t);
+  drained("unlinked file", t);
+
+  t = uptime();
+  if((fd[0] = open("rm.b", O_WRONLY|O_TRUNC)) < 0){
+    printf("rmbench: open O_TRUNC failed\n");
+    exit(1);
+  }
+  printf("rmbench: open(O_TRUNC) took %d ticks\n", uptime() - t);
+  close(fd[0]);
+  drained("truncated file", t);
+
+  unlink("rm.b");
+  printf("rmbench: OK\n");
+  exit(0);
+}
@@ -0,0 +1,108 @@
+//
+// seqread [file]
+//
+// Sequential read throughput benchmark. Reads a file (by default
+// one it creates) from start to end with a cold buffer cache,
+// and reports the time taken, how many of the blocks had
+// already been read ahead when read() asked for them, and how
+// many times the file system read a block from the buffer cache
+// -- once per block, if looking up where they are doesn't read
+// anything more, as with the block map cache.
+//
+// To empty the cache, a child process allocates memory until
+// none is left, which makes kalloc() reclaim the cache's unused
+// buffers.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NBLOCK  128   // size of the file we create
+#define ROUNDS  4
+
+char buf[BSIZE];
+struct fsstat st0, st1;
+
+void
+makefile(char *name)
+{
+  int fd, i;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("seqread: create %s failed\n", name);
+    exit(1);
+  }
+  for(i = 0; i < NBLOCK; i++){
+    memset(buf, i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("seqread: write failed\n");
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// push the file's blocks out of the buffer cache.
+void
+dropcache(void)
+{
+  int pid = fork();
+  if(pid < 0){
+    printf("seqread: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    while(sbrk(1024*1024) != (char*)-1)
+      ;
+    exit(0);
+  }
+  wait(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "seqfile";
+  int fd, n, r, t, ticks;
+  uint64 bytes;
+
+  if(argc > 1)
+    name = argv[1];
+  else
+    makefile(name);
+
+  ticks = 0;
+  bytes = 0;
+  for(r = 0; r < ROUNDS; r++){
+    dropcache();
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("seqread: open %s failed\n", name);
+      exit(1);
+    }
+    fsstat(&st0);
+    t = uptime();
+    while((n = read(fd, buf, BSIZE)) > 0)
+      bytes += n;
+    ticks += uptime() - t;
+    close(fd);
+    fsstat(&st1);
+    st1.bhit -= st0.bhit;
+    st1.bmiss -= st0.bmiss;
+    st1.rahead -= st0.rahead;
+    printf("seqread: round %d: %l misses, %l blocks read ahead, %l breads\n",
+           r, st1.bmiss, st1.rahead, st1.bhit + st1.bmiss);
+  }
+  if(ticks < 1)
+    ticks = 1;
+  printf("seqread: %l KB in %d ticks, %l KB/tick\n",
+         bytes / 1024, ticks, bytes / 1024 / ticks);
+
+  if(argc <= 1)
+    unlink(name);
+  exit(0);
+}
@@ -0,0 +1,145 @@
+//
+// smallfiles [ndir]
+//
+// Small-file locality benchmark. Creates ndir directories of
+// NFILE files of a few blocks each, working through the
+// directories in turn, then reads every file back a directory
+// at a time and deletes them. For each phase prints the time it
+// took and the disk requests, seeks and average seek distance
+// from fsstat(). With block groups, a directory's inodes and
+// their files' blocks sit together, so seeks should be short.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NFILE  50
+#define NBLOCK 3     // blocks per file
+
+char buf[BSIZE];
+struct fsstat before, after;
+int t0;
+
+void
+name(char *s, int d, int f)
+{
+  strcpy(s, "sfXX/fXX");
+  s[2] = 'a' + d / 26;
+  s[3] = 'a' + d % 26;
+  s[6] = 'a' + f / 26;
+  s[7] = 'a' + f % 26;
+}
+
+void
+start(void)
+{
+  sync();
+  fsstat(&before);
+  t0 = uptime();
+}
+
+void
+report(char *phase)
+{
+  uint64 nseek;
+
+  sync();
+  fsstat(&after);
+  nseek = after.nseek - before.nseek;
+  printf("smallfiles: %s %d ticks, %l requests, %l seeks, %l blocks average seek\n",
+         phase, uptime() - t0, after.ndiskreq - before.ndiskreq, nseek,
+         nseek ? (after.seekdist - before.seekdist) / nseek : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int ndir, d, f, b, fd;
+
+  ndir = 8;
+  if(argc > 1)
+    ndir = atoi(argv[1]);
+  if(ndir < 1 || ndir > 26*26){
+    fprintf(2, "usage: smallfiles [ndir]\n");
+    exit(1);
+  }
+
+  printf("smallfiles: %d directories of %d %d-block files\n", ndir, NFILE, NBLOCK);
+  for(d = 0; d < ndir; d++){
+    name(path, d, 0);
+    path[4] = 0;
+    if(mkdir(path) < 0){
+      printf("smallfiles: mkdir %s failed\n", path);
+      exit(1);
+    }
+  }
+
+  // create the files a directory at a time round robin, so that
+  // an allocator without locality interleaves their blocks.
+  start();
+  for(f = 0; f < NFILE; f++){
+    for(d = 0; d < ndir; d++){
+      name(path, d, f);
+      fd = open(path, O_CREATE|O_WRONLY);
+      if(fd < 0){
+        printf("smallfiles: create %s failed\n", path);
+        exit(1);
+      }
+      memset(buf, d + f, BSIZE);
+      for(b = 0; b < NBLOCK; b++){
+        if(write(fd, buf, BSIZE) != BSIZE){
+          printf("smallfiles: write %s failed\n", path);
+          exit(1);
+        }
+      }
+      close(fd);
+    }
+  }
+  report("create");
+
+  start();
+  for(d = 0; d < ndir; d++){
+    for(f = 0; f < NFILE; f++){
+      name(path, d, f);
+      fd = open(path, O_RDONLY);
+      if(fd < 0){
+        printf("smallfiles: open %s failed\n", path);
+        exit(1);
+      }
+      for(b = 0; b < NBLOCK; b++){
+        if(read(fd, buf, BSIZE) != BSIZE || buf[0] != (char)(d + f)){
+          printf("smallfiles: read %s failed\n", path);
+          exit(1);
+        }
+      }
+      close(fd);
+    }
+  }
+  report("read");
+
+  start();
+  for(d = 0; d < ndir; d++){
+    for(f = 0; f < NFILE; f++){
+      name(path, d, f);
+      if(unlink(path) < 0){
+        printf("smallfiles: unlink %s failed\n", path);
+        exit(1);
+      }
+    }
+    name(path, d, 0);
+    path[4] = 0;
+    if(unlink(path) < 0){
+      printf("smallfiles: unlink %s failed\n", path);
+      exit(1);
+    }
+  }
+  report("delete");
+
+  printf("smallfiles: OK\n");
+  exit(0);
+}
@@ -0,0 +1,56 @@
+//
+// Group commit benchmark.
+//
+// Does many small write()s to a file, each its own FS transaction,
+// then fsync()s it. With a commit delay, most of the transactions
+// should be absorbed into a few commits.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NWRITE 500
+#define WSIZE  16
+
+struct fsstat st0, st1;
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "smallwrite.tmp";
+  char buf[WSIZE];
+  int fd, i, t;
+
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("smallwrite: create failed\n");
+    exit(1);
+  }
+  sync();
+
+  memset(buf, 'x', sizeof(buf));
+  fsstat(&st0);
+  t = uptime();
+  for(i = 0; i < NWRITE; i++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("smallwrite: write failed\n");
+      exit(1);
+    }
+  }
+  if(fsync(fd) < 0){
+    printf("smallwrite: fsync failed\n");
+    exit(1);
+  }
+  t = uptime() - t;
+  fsstat(&st1);
+  close(fd);
+  unlink(name);
+
+  printf("smallwrite: %d writes of %d bytes in %d ticks\n", NWRITE, WSIZE, t);
+  printf("smallwrite: %l commits, %l commits avoided\n",
+         st1.ncommit - st0.ncommit, st1.nbatched - st0.nbatched);
+  exit(0);
+}
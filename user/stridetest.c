@@ -0,0 +1,115 @@
+//
+// Test that the stride scheduling class divides the CPU in
+// proportion to tickets. Runs grind-style CPU loops in children
+// with different shares for a fixed number of ticks and compares
+// how much work each share class got done.
+//
+// There are more children than harts (for the default CPUS=3),
+// so that the children compete for the CPU rather than each
+// getting a hart to itself.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCLASS  3
+#define NPER    4         // children per share class
+#define NCHILD  (NCLASS*NPER)
+#define TICKS   30        // length of the measurement
+#define SLOP    25        // allowed deviation, in percent
+
+int shares[NCLASS] = { 10, 20, 30 };
+
+struct result {
+  int class;
+  uint64 work;
+};
+
+// spin until the deadline, counting loop iterations.
+uint64
+grind(int deadline)
+{
+  uint64 work = 0;
+  volatile uint64 x = 1;
+
+  while(uptime() < deadline){
+    for(int i = 0; i < 10000; i++)
+      x = x * 1103515245 + 12345;
+    work++;
+  }
+  return work;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fds[2], deadline;
+  uint64 work[NCLASS], norm[NCLASS], mean;
+  struct result r;
+
+  printf("stridetest: start\n");
+
+  if(pipe(fds) < 0){
+    printf("stridetest: pipe failed\n");
+    exit(1);
+  }
+
+  deadline = uptime() + TICKS + 2;
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("stridetest: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      r.class = i % NCLASS;
+      if(settickets(shares[r.class]) < 0){
+        printf("stridetest: settickets failed\n");
+        exit(1);
+      }
+      // wait for all the children to be forked.
+      while(uptime() < deadline - TICKS)
+        ;
+      r.work = grind(deadline);
+      write(fds[1], &r, sizeof(r));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+
+  memset(work, 0, sizeof(work));
+  while(read(fds[0], &r, sizeof(r)) == sizeof(r))
+    work[r.class] += r.work;
+  for(int i = 0; i < NCHILD; i++)
+    wait(0);
+
+  // work per ticket should be the same for every class.
+  mean = 0;
+  for(int c = 0; c < NCLASS; c++){
+    norm[c] = work[c] / shares[c];
+    mean += norm[c];
+  }
+  mean /= NCLASS;
+  if(mean == 0){
+    printf("stridetest: no work done\n");
+    exit(1);
+  }
+
+  int ok = 1;
+  for(int c = 0; c < NCLASS; c++){
+    int pct = norm[c] * 100 / mean;
+    printf("tickets %d: work %d (%d%% of expected)\n",
+           shares[c], (int)work[c], pct);
+    if(pct < 100 - SLOP || pct > 100 + SLOP)
+      ok = 0;
+  }
+
+  if(!ok){
+    printf("stridetest: FAILED\n");
+    exit(1);
+  }
+  printf("stridetest: OK\n");
+  exit(0);
+}
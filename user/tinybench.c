@@ -0,0 +1,104 @@
+//
+// tinybench [nfiles]
+//
+// Tiny file benchmark. Creates nfiles files of a few dozen bytes
+// each in a new directory, like config files and short scripts,
+// then reads each back, checking it. Prints how many blocks the
+// files took and how many block reads reading them did, from
+// fsstat(); files that fit in their inodes take neither.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define SIZE 60  // bytes in each file
+
+struct fsstat before, after;
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "tb.d/fXXX");
+  s[6] = 'a' + i / 676;
+  s[7] = 'a' + i / 26 % 26;
+  s[8] = 'a' + i % 26;
+}
+
+// The contents of file i.
+void
+fill(char *buf, int i)
+{
+  int j;
+
+  for(j = 0; j < SIZE; j++)
+    buf[j] = 'a' + (i + j) % 26;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16], buf[SIZE], got[SIZE+1];
+  int nfiles, i, fd, t;
+  uint blocks;
+  struct stat st;
+
+  nfiles = 500;
+  if(argc > 1)
+    nfiles = atoi(argv[1]);
+  if(nfiles < 1 || nfiles > 26*26*26){
+    fprintf(2, "usage: tinybench [nfiles]\n");
+    exit(1);
+  }
+
+  if(mkdir("tb.d") < 0){
+    printf("tinybench: mkdir failed\n");
+    exit(1);
+  }
+  fsstat(&before);
+  t = uptime();
+  blocks = 0;
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    fill(buf, i);
+    if((fd = open(path, O_CREATE|O_WRONLY)) < 0 || write(fd, buf, SIZE) != SIZE){
+      printf("tinybench: create %s failed\n", path);
+      exit(1);
+    }
+    fstat(fd, &st);
+    blocks += st.blocks;
+    close(fd);
+  }
+  t = uptime() - t;
+  fsstat(&after);
+  printf("tinybench: create %d files of %d bytes: %d ticks\n", nfiles, SIZE, t);
+  printf("tinybench: %d data blocks, %l blocks used with the directory's\n",
+         blocks, before.nfree - after.nfree);
+
+  fsstat(&before);
+  t = uptime();
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    fill(buf, i);
+    if((fd = open(path, O_RDONLY)) < 0 || read(fd, got, sizeof(got)) != SIZE
+       || memcmp(buf, got, SIZE) != 0){
+      printf("tinybench: read %s failed\n", path);
+      exit(1);
+    }
+    close(fd);
+  }
+  t = uptime() - t;
+  fsstat(&after);
+  printf("tinybench: read %d files: %d ticks, %l block reads\n", nfiles, t,
+         (after.bhit - before.bhit) + (after.bmiss - before.bmiss));
+
+  for(i = 0; i < nfiles; i++){
+    name(path, i);
+    unlink(path);
+  }
+  unlink("tb.d");
+  printf("tinybench: OK\n");
+  exit(0);
+}
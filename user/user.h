@@ -1,5 +1,7 @@
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct fsstat;
 
 // system calls
 int fork(void);
@@ -23,6 +25,12 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int settickets(int);
+int lockstat(struct lockstat*, int);
+int lockreset(void);
+int fsstat(struct fsstat*);
+int sync(void);
+int fsync(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
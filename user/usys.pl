@@ -36,3 +36,9 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("settickets");
+entry("lockstat");
+entry("lockreset");
+entry("fsstat");
+entry("sync");
+entry("fsync");
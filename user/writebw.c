@@ -0,0 +1,80 @@
+//
+// Large write bandwidth test.
+//
+// Writes a large file a block at a time and fsync()s it, then
+// reads it back to check it. With ordered-mode logging the
+// file's data blocks are written in place, not through the log,
+// so reports how many went each way.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "kernel/fsstat.h"
+#include "user/user.h"
+
+#define NBLOCK 200
+
+char buf[BSIZE];
+struct fsstat st0, st1;
+
+int
+main(int argc, char *argv[])
+{
+  char *name = "writebw.tmp";
+  int fd, i, j, t;
+
+  printf("writebw: start\n");
+  sync();
+  fsstat(&st0);
+  t = uptime();
+  fd = open(name, O_CREATE|O_WRONLY|O_TRUNC);
+  if(fd < 0){
+    printf("writebw: create failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NBLOCK; i++){
+    for(j = 0; j < BSIZE; j++)
+      buf[j] = i + j;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("writebw: write failed\n");
+      exit(1);
+    }
+  }
+  if(fsync(fd) < 0){
+    printf("writebw: fsync failed\n");
+    exit(1);
+  }
+  close(fd);
+  t = uptime() - t;
+  fsstat(&st1);
+  if(t < 1)
+    t = 1;
+
+  fd = open(name, O_RDONLY);
+  if(fd < 0){
+    printf("writebw: open failed\n");
+    exit(1);
+  }
+  for(i = 0; i < NBLOCK; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf("writebw: short read\n");
+      exit(1);
+    }
+    for(j = 0; j < BSIZE; j++){
+      if(buf[j] != (char)(i + j)){
+        printf("writebw: wrong data in block %d\n", i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  unlink(name);
+
+  printf("writebw: %d blocks in %d ticks, %d blocks/tick\n", NBLOCK, t, NBLOCK / t);
+  printf("writebw: %l commits, %l data blocks written in place\n",
+         st1.ncommit - st0.ncommit, st1.nordered - st0.nordered);
+  printf("writebw: OK\n");
+  exit(0);
+}